@@ -19,7 +19,7 @@ namespace levidb::db_bench {
 
     public:
         void Set(const Slice & k, const Slice & v) override {
-            map_.emplace(k.ToString(), v.ToString());
+            map_[k.ToString()] = v.ToString();
         }
 
         bool Get(const Slice & k, std::string * v) const override {
@@ -0,0 +1,35 @@
+#pragma once
+#ifndef LEVIDB_BULK_LOADER_H
+#define LEVIDB_BULK_LOADER_H
+
+/*
+ * 批量导入
+ * 记录顺序写入新的压缩 Store, 不经过索引
+ * Finish 时各 index 并行插入 token, 之后数据才可见
+ *
+ * 注意:
+ * 1. **线程不安全**
+ * 2. 同一 key 出现多次时以最后一次为准
+ * 3. 未 Finish 即析构, 已写出的 Store 被删除
+ * 4. Add 以 Status 报告错误, 长度上限与 DB 的写接口相同
+ * 5. 创建 BulkLoader 之后经由 DB 写入或删除的 key 以 DB 的写入为准, 不被导入覆盖
+ */
+
+#include "slice.h"
+#include "status.h"
+
+namespace levidb {
+    class BulkLoader {
+    public:
+        BulkLoader() = default;
+
+        virtual ~BulkLoader() = default;
+
+    public:
+        virtual Status Add(const Slice & k, const Slice & v) = 0;
+
+        virtual void Finish() = 0;
+    };
+}
+
+#endif //LEVIDB_BULK_LOADER_H
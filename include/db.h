@@ -9,14 +9,38 @@
  * 1. 所有方法 **线程安全**
  * 2. std::unique_ptr<Iterator> **线程不安全**
  * 3. 索引无法区分 "abc\0\0" 与 "abc\0"
+ * 4. 写接口以 Status 报告错误, 不抛出异常
+ * 5. key 长度上限 2^24 - 1, key 与 value 合计上限 512MB(更大的 value 用 AddStream)
+ *    WriteBatch 的总长同样受此限制, 超出时写接口返回 InvalidArgument
  */
 
+#include <chrono>
+#include <functional>
+#include <future>
 #include <memory>
 
+#include "bulk_loader.h"
 #include "iterator.h"
 #include "options.h"
+#include "status.h"
+#include "update_iterator.h"
+#include "value_stream.h"
+#include "write_batch.h"
 
 namespace levidb {
+    // [start, limit), limit 为空表示不限
+    struct Range {
+        Slice start;
+        Slice limit;
+
+        Range() = default;
+
+        Range(const Slice & s, const Slice & l) : start(s), limit(l) {}
+    };
+
+    // 返回 false 时所有线程尽快结束
+    using ScanCallback = std::function<bool(const Slice & k, const Slice & v)>;
+
     class DB {
     public:
         DB() = default;
@@ -30,14 +54,79 @@ namespace levidb {
         virtual std::unique_ptr<Iterator>
         GetIterator() const = 0;
 
-        virtual void Add(const Slice & k, const Slice & v) = 0;
+        // 无序全量扫描, 每个 index 由一个线程独立遍历, 不经过归并
+        // callback 会被多个线程同时调用; 范围为 [begin, end), nullptr 表示不限
+        virtual void ParallelScan(size_t num_threads, const ScanCallback & callback,
+                                  const Slice * begin, const Slice * end) const = 0;
+
+        // 按写入顺序顺序读取各 Store 文件, 只回调仍被索引引用的记录
+        // 多个 Store 并行读取; 只覆盖调用时已落盘的记录
+        virtual void PhysicalScan(size_t num_threads, const ScanCallback & callback) const = 0;
+
+        // 变更流, 从 Store seq 中 id 处的记录开始(包含该记录), (0, 0) 表示最早的记录
+        // id 须为 UpdateIterator::Id() 的返回值或 0
+        // 日志由整个 DB 共用, 只返回带有本 keyspace 标记的记录, 对 DB 调用时为不带标记的记录
+        virtual std::unique_ptr<UpdateIterator>
+        GetUpdatesSince(size_t seq, size_t id) const = 0;
+
+        virtual Status Add(const Slice & k, const Slice & v) = 0;
+
+        // ttl 之后 k 对 Get 与迭代不可见, 全部记录都过期的 Store 在 Compact 时整体删除
+        virtual Status Add(const Slice & k, const Slice & v, std::chrono::seconds ttl) = 0;
+
+        virtual Status Del(const Slice & k) = 0;
+
+        // 以下两个方法在 k 所属 shard 的锁内完成判断与写入, 结果写入出参, 出错时出参为 false
+        virtual Status PutIfAbsent(const Slice & k, const Slice & v, bool * inserted) = 0;
+
+        // k 不存在时 *swapped 为 false
+        virtual Status CompareAndSwap(const Slice & k, const Slice & expected, const Slice & v, bool * swapped) = 0;
+
+        // 只写入 operand, 不读取旧值; 未提供 OpenOptions::merge_operator 时返回 NotSupported
+        virtual Status Merge(const Slice & k, const Slice & operand) = 0;
+
+        // batch 中的写入一次性对其他线程可见, 可跨越同一 DB 的多个 keyspace
+        // 记录带有同一个 batch id, 全部写入后追加提交标记, 恢复时据此整体应用或整体丢弃
+        virtual Status Write(const WriteBatch & batch) = 0;
+
+        // 超大 value 分块写入独立的 blob 文件, 内存中只有一个块
+        virtual Status AddStream(const Slice & k, ValueReader * reader) = 0;
+
+        virtual std::unique_ptr<ValueReader> /* nullptr if not found */
+        GetStream(const Slice & k) const = 0;
+
+        // 异步接口, 开启 shard_affinity 时由 key 所属 shard 的线程执行
+        // k, v 被拷贝; v(出参) 须存活至 future 就绪
+        virtual std::future<bool> /* success? */
+        GetAsync(const Slice & k, std::string * v) const = 0;
+
+        virtual std::future<void> AddAsync(const Slice & k, const Slice & v) = 0;
+
+        virtual std::future<void> DelAsync(const Slice & k) = 0;
+
+        // 精确的 key 数量(含已过期但尚未清理的 key)
+        virtual uint64_t Count() const = 0;
+
+        // 由各 index 的 key 样本估算, 不读取任何记录
+        virtual void GetApproximateSizes(const Range * ranges, size_t n, uint64_t * sizes) const = 0;
+
+        virtual void GetApproximateCount(const Range * ranges, size_t n, uint64_t * counts) const = 0;
+
+        // sorted 表示输入已按 key 升序
+        virtual std::unique_ptr<BulkLoader>
+        NewBulkLoader(bool sorted) = 0;
 
-        virtual void Del(const Slice & k) = 0;
+        // 与 DB 共用 Store 与 Compact, 有独立的 index; 返回值由 DB 持有, 随 DB 一同关闭
+        // options 中只有 index 相关的字段生效, Store 相关的字段沿用 DB 的设置
+        // 重复打开返回同一个 keyspace, 忽略 options
+        virtual DB *
+        OpenKeyspace(const std::string & name, const OpenOptions & options) = 0;
 
+        // 整个 DB 共用, 对 keyspace 调用等同于对 DB 调用
         virtual bool /* can do more? */
         Compact() = 0;
 
-        virtual void Sync() = 0;
+        virtual Status Sync() = 0;
 
     public:
         static std::shared_ptr<DB>
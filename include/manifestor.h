@@ -6,6 +6,10 @@
  * Metadata 存储接口
  */
 
+#include <string>
+#include <utility>
+#include <vector>
+
 #include "slice.h"
 
 namespace levidb {
@@ -20,6 +24,13 @@ namespace levidb {
 
         virtual bool Get(const Slice & k, std::string * v) const = 0;
 
+        // 一组修改同时生效; 默认逐个 Set, 不保证原子性
+        virtual void Commit(const std::vector<std::pair<std::string, std::string>> & kvs) {
+            for (const auto & [k, v]:kvs) {
+                Set(k, v);
+            }
+        }
+
         virtual void Set(const Slice & k, int64_t v) {
             Set(k, {reinterpret_cast<char *>(&v), sizeof(v)});
         }
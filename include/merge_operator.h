@@ -0,0 +1,32 @@
+#pragma once
+#ifndef LEVIDB_MERGE_OPERATOR_H
+#define LEVIDB_MERGE_OPERATOR_H
+
+/*
+ * 用户定义的合并操作
+ * DB::Merge 只追加 operand, Get/迭代时按写入顺序折叠
+ *
+ * 注意:
+ * 1. Merge 需要是确定性的, 同一组输入总得到同一结果
+ * 2. 可能被多个线程同时调用
+ */
+
+#include <string>
+
+#include "slice.h"
+
+namespace levidb {
+    class MergeOperator {
+    public:
+        MergeOperator() = default;
+
+        virtual ~MergeOperator() = default;
+
+    public:
+        // existing == nullptr 表示 key 此前不存在
+        virtual void Merge(const Slice & k, const Slice * existing, const Slice & operand,
+                           std::string * result) const = 0;
+    };
+}
+
+#endif //LEVIDB_MERGE_OPERATOR_H
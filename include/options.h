@@ -6,11 +6,48 @@
  * 运行时参数
  */
 
+#include <cstdint>
+#include <string>
+#include <vector>
+
 #include "manifestor.h"
+#include "merge_operator.h"
 
 namespace levidb {
     struct OpenOptions {
+        // 为空时使用内置实现, 存放于 DB 目录下的 MANIFEST
         Manifestor * manifestor = nullptr;
+        // DB::Merge 所需, 重新打开含 merge 记录的 DB 时必须提供同一实现
+        const MergeOperator * merge_operator = nullptr;
+
+        // 封存的 Store 不超过此长度时以 mmap 读取, 0 表示一律 pread
+        // 映射提示为 MADV_RANDOM; PhysicalScan 与变更流各自以顺序读打开文件, 不影响共享的映射
+        size_t mmap_store_limit = 0;
+        // 封存的 Store 以 O_DIRECT 读取, 由内置 Buffer Pool 缓存(优先于 mmap)
+        bool direct_io = false;
+        size_t buffer_pool_size = 256 * 1024 * 1024;
+
+        // 每个 index 预留的虚拟地址空间, 文件在其中按 segment 增长
+        size_t index_reserve_size = static_cast<size_t>(64) * 1024 * 1024 * 1024;
+        // 不小于此长度的 value 单独存放, 比较 key 与只读 key 的迭代不会读到 value
+        size_t value_separate_threshold = 4096;
+        // 每个 index 维护一个内存中的 Cuckoo Filter, 不存在的 key 无需读 Store; 每个 key 占 8~16 字节
+        bool lookup_filter = false;
+        // 重启时每个 index 预先载入的字节数, 从文件头开始(不保证覆盖树的上层)
+        size_t index_warmup_size = 0;
+        // index 映射使用透明大页, 减少 TLB miss
+        bool index_huge_pages = false;
+        // 每个 index 由一个绑核的线程独占执行, 调用方通过队列投递操作
+        bool shard_affinity = false;
+        // 可写 Store 的追加缓冲, 0 表示每条记录直接写入文件(崩溃时缓冲中的记录会丢失)
+        size_t write_buffer_size = 0;
+        // 后台线程定时刷出追加缓冲, 0 表示只在缓冲写满, Sync 或 sync 写入时刷出
+        size_t write_flush_interval_ms = 0;
+        // level_paths[l] 为第 l 层 Store 所在目录(可位于其他设备), 缺省或为空时使用 DB 目录
+        // 重新打开时须与上次一致, 否则找不到已有的 Store
+        std::vector<std::string> level_paths;
+        // 封存超过此秒数的 0 层 Store 在 Compact 时移至 1 层, 0 表示不迁移
+        uint64_t cold_store_age = 0;
     };
 }
 
@@ -0,0 +1,56 @@
+#pragma once
+#ifndef LEVIDB_STATUS_H
+#define LEVIDB_STATUS_H
+
+/*
+ * 写接口的返回值
+ * 成功时不分配内存, 失败时携带错误信息
+ */
+
+#include <string>
+
+#include "slice.h"
+
+namespace levidb {
+    class Status {
+    public:
+        enum Code {
+            kOk = 0,
+            kNotSupported,
+            kInvalidArgument,
+            kIOError,
+        };
+
+    private:
+        Code code_;
+        std::string msg_;
+
+        Status(Code code, const Slice & msg) : code_(code), msg_(msg.ToString()) {}
+
+    public:
+        Status() : code_(kOk) {}
+
+        static Status OK() { return {}; }
+
+        static Status NotSupported(const Slice & msg) { return {kNotSupported, msg}; }
+
+        static Status InvalidArgument(const Slice & msg) { return {kInvalidArgument, msg}; }
+
+        static Status IOError(const Slice & msg) { return {kIOError, msg}; }
+
+    public:
+        bool Ok() const { return code_ == kOk; }
+
+        bool IsNotSupported() const { return code_ == kNotSupported; }
+
+        bool IsInvalidArgument() const { return code_ == kInvalidArgument; }
+
+        bool IsIOError() const { return code_ == kIOError; }
+
+        Code GetCode() const { return code_; }
+
+        const std::string & GetMessage() const { return msg_; }
+    };
+}
+
+#endif //LEVIDB_STATUS_H
\ No newline at end of file
@@ -0,0 +1,59 @@
+#pragma once
+#ifndef LEVIDB_UPDATE_ITERATOR_H
+#define LEVIDB_UPDATE_ITERATOR_H
+
+/*
+ * 变更流
+ * 按写入顺序读取 Store 日志, 包括 Del 写入的 tombstone
+ * 读到末尾后 Valid() 为 false, 再次调用 Next() 继续读取此后落盘的记录
+ *
+ * 注意:
+ * 1. **线程不安全**
+ * 2. 整个 DB 共用一份日志, 按记录的 keyspace 标记只返回所属 keyspace 的写入与删除
+ *    早于 keyspace 标记写入的 keyspace 记录不带标记, 出现在 DB 自身的变更流中
+ * 3. WriteBatch 的记录按落盘顺序返回, 不等待其提交标记
+ * 4. 被 Compact 删除的 Store 被跳过; 批量导入的 Store 在 Finish 后整体出现
+ */
+
+#include <cstddef>
+#include <cstdint>
+
+#include "slice.h"
+
+namespace levidb {
+    class UpdateIterator {
+    public:
+        enum Type {
+            kPut,
+            kDel,
+            kMerge,
+        };
+
+    public:
+        UpdateIterator() = default;
+
+        virtual ~UpdateIterator() = default;
+
+    public:
+        virtual bool Valid() const = 0;
+
+        virtual void Next() = 0;
+
+        virtual Type GetType() const = 0;
+
+        virtual Slice Key() const = 0;
+
+        // kDel 时为空, kMerge 时为 operand
+        virtual Slice Value() const = 0;
+
+        // 0 表示永不过期, 已过期的记录同样返回
+        virtual uint64_t Expire() const = 0;
+
+        // 当前记录的位置, 传给 GetUpdatesSince 可从这条记录处恢复
+        virtual size_t Seq() const = 0;
+
+        virtual size_t Id() const = 0;
+    };
+}
+
+#endif //LEVIDB_UPDATE_ITERATOR_H
\ No newline at end of file
@@ -0,0 +1,24 @@
+#pragma once
+#ifndef LEVIDB_VALUE_STREAM_H
+#define LEVIDB_VALUE_STREAM_H
+
+/*
+ * 大 value 的流式读写接口
+ */
+
+#include <cstddef>
+
+namespace levidb {
+    class ValueReader {
+    public:
+        ValueReader() = default;
+
+        virtual ~ValueReader() = default;
+
+    public:
+        virtual size_t /* 0 -> end */
+        Read(size_t n, char * scratch) = 0;
+    };
+}
+
+#endif //LEVIDB_VALUE_STREAM_H
@@ -0,0 +1,53 @@
+#pragma once
+#ifndef LEVIDB_WRITE_BATCH_H
+#define LEVIDB_WRITE_BATCH_H
+
+/*
+ * 跨 keyspace 的批量写入
+ * 由 DB::Write 一次性生效, 其他线程看不到只写了一部分的 batch
+ *
+ * 注意:
+ * 1. **线程不安全**
+ * 2. key 长度, keyspace, index 页与 Store 空间都在写入前检查与预留, 这些错误不会留下部分写入
+ * 3. 写入中途出现 IO 错误时已写入的记录仍在索引中生效, Write 返回错误
+ *    日志中这些记录没有提交标记, 从日志恢复时整体丢弃; 崩溃后同样如此
+ */
+
+#include <string>
+#include <vector>
+
+#include "slice.h"
+
+namespace levidb {
+    class DB;
+
+    class WriteBatch {
+    private:
+        struct Op {
+            DB * keyspace;
+            std::string k;
+            std::string v;
+            bool del;
+        };
+
+        std::vector<Op> ops_;
+
+        friend class DBImpl;
+
+    public:
+        // keyspace 为 DB 自身或 DB::OpenKeyspace 的返回值
+        void Add(DB * keyspace, const Slice & k, const Slice & v) {
+            ops_.push_back({keyspace, k.ToString(), v.ToString(), false});
+        }
+
+        void Del(DB * keyspace, const Slice & k) {
+            ops_.push_back({keyspace, k.ToString(), {}, true});
+        }
+
+        void Clear() { ops_.clear(); }
+
+        size_t Size() const { return ops_.size(); }
+    };
+}
+
+#endif //LEVIDB_WRITE_BATCH_H
\ No newline at end of file
@@ -0,0 +1,89 @@
+#include <algorithm>
+
+#include "env.h"
+
+#include "blob.h"
+
+namespace levidb {
+    static constexpr size_t kChunkSize = 1024 * 1024;
+
+    class BlobReader : public ValueReader {
+    private:
+        std::unique_ptr<penv::RandomAccessFile> file_;
+        size_t offset_;
+        size_t size_;
+
+    public:
+        BlobReader(std::unique_ptr<penv::RandomAccessFile> && file, size_t size)
+                : file_(std::move(file)),
+                  offset_(0),
+                  size_(size) {}
+
+        ~BlobReader() override = default;
+
+    public:
+        size_t Read(size_t n, char * scratch) override {
+            n = std::min(n, size_ - offset_);
+            if (n != 0) {
+                file_->ReadAt(offset_, n, scratch);
+                offset_ += n;
+            }
+            return n;
+        }
+    };
+
+    class StringReader : public ValueReader {
+    private:
+        std::string s_;
+        size_t offset_;
+
+    public:
+        explicit StringReader(std::string && s)
+                : s_(std::move(s)),
+                  offset_(0) {}
+
+        ~StringReader() override = default;
+
+    public:
+        size_t Read(size_t n, char * scratch) override {
+            n = std::min(n, s_.size() - offset_);
+            memcpy(scratch, s_.data() + offset_, n);
+            offset_ += n;
+            return n;
+        }
+    };
+
+    size_t WriteBlob(const std::string & fname, ValueReader * reader) {
+        auto file = penv::Env::Default()->OpenWritableFile(fname);
+        std::string chunk(kChunkSize, 0);
+        size_t size = 0;
+        while (true) {
+            size_t n = reader->Read(kChunkSize, &chunk[0]);
+            if (n == 0) {
+                break;
+            }
+            file->PrepareWrite(size, n);
+            file->Write(n == kChunkSize ? chunk : chunk.substr(0, n));
+            size += n;
+        }
+        file->Sync();
+        return size;
+    }
+
+    std::unique_ptr<ValueReader>
+    OpenBlob(const std::string & fname, size_t size) {
+        return std::make_unique<BlobReader>(penv::Env::Default()->OpenRandomAccessFie(fname), size);
+    }
+
+    void ReadBlob(const std::string & fname, size_t size, std::string * v) {
+        v->resize(size);
+        if (size != 0) {
+            penv::Env::Default()->OpenRandomAccessFie(fname)->ReadAt(0, size, &(*v)[0]);
+        }
+    }
+
+    std::unique_ptr<ValueReader>
+    OpenStringReader(std::string && s) {
+        return std::make_unique<StringReader>(std::move(s));
+    }
+}
@@ -0,0 +1,31 @@
+#pragma once
+#ifndef LEVIDB_BLOB_H
+#define LEVIDB_BLOB_H
+
+/*
+ * Blob 文件
+ * 超大 value 分块写入独立的文件, Store 中的记录只保存 blob 的 seq 与长度
+ * 读取同样分块进行, 任何时刻内存中只有一个块
+ */
+
+#include <memory>
+#include <string>
+
+#include "../include/slice.h"
+#include "../include/value_stream.h"
+
+namespace levidb {
+    size_t /* size */
+    WriteBlob(const std::string & fname, ValueReader * reader);
+
+    std::unique_ptr<ValueReader>
+    OpenBlob(const std::string & fname, size_t size);
+
+    void ReadBlob(const std::string & fname, size_t size, std::string * v);
+
+    // 非 blob 的 value 也以同样的接口返回
+    std::unique_ptr<ValueReader>
+    OpenStringReader(std::string && s);
+}
+
+#endif //LEVIDB_BLOB_H
@@ -0,0 +1,78 @@
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#include "buffer_pool.h"
+
+namespace levidb {
+    BufferPool::BufferPool(size_t capacity)
+            : arena_(nullptr),
+              frames_(std::max<size_t>(capacity / kBlockSize, 1)),
+              protected_limit_(frames_.size() * 4 / 5) {
+        void * p;
+        if (posix_memalign(&p, kAlignment, frames_.size() * kBlockSize) != 0) {
+            throw std::bad_alloc();
+        }
+        arena_ = static_cast<char *>(p);
+        free_.reserve(frames_.size());
+        for (size_t i = frames_.size(); i > 0; --i) {
+            free_.emplace_back(i - 1);
+        }
+    }
+
+    BufferPool::~BufferPool() {
+        free(arena_);
+    }
+
+    bool BufferPool::Lookup(size_t seq, size_t block, size_t offset, size_t n, char * scratch) {
+        assert(offset + n <= kBlockSize);
+        std::lock_guard guard(mutex_);
+        auto it = map_.find(Key(seq, block));
+        if (it == map_.cend()) {
+            return false;
+        }
+
+        size_t idx = it->second;
+        Frame & frame = frames_[idx];
+        if (frame.is_protected) {
+            protected_.splice(protected_.begin(), protected_, frame.pos);
+        } else {
+            probation_.erase(frame.pos);
+            frame.is_protected = true;
+            frame.pos = protected_.insert(protected_.begin(), idx);
+            if (protected_.size() > protected_limit_) {
+                size_t demote = protected_.back();
+                protected_.pop_back();
+                frames_[demote].is_protected = false;
+                frames_[demote].pos = probation_.insert(probation_.begin(), demote);
+            }
+        }
+        memcpy(scratch, FrameData(idx) + offset, n);
+        return true;
+    }
+
+    void BufferPool::Insert(size_t seq, size_t block, const char * data) {
+        uint64_t key = Key(seq, block);
+        std::lock_guard guard(mutex_);
+        if (map_.find(key) != map_.cend()) {
+            return;
+        }
+
+        size_t idx;
+        if (!free_.empty()) {
+            idx = free_.back();
+            free_.pop_back();
+        } else {
+            std::list<size_t> & victims = probation_.empty() ? protected_ : probation_;
+            idx = victims.back();
+            victims.pop_back();
+            map_.erase(frames_[idx].key);
+        }
+
+        memcpy(FrameData(idx), data, kBlockSize);
+        frames_[idx] = {key, false, probation_.insert(probation_.begin(), idx)};
+        map_.emplace(key, idx);
+    }
+}
@@ -0,0 +1,71 @@
+#pragma once
+#ifndef LEVIDB_BUFFER_POOL_H
+#define LEVIDB_BUFFER_POOL_H
+
+/*
+ * 用户态 Buffer Pool
+ * 缓存 O_DIRECT 读取的封存 Store, 内存用量固定
+ *
+ * 淘汰策略为 SLRU:
+ * 新 block 进入 probation 段, 再次命中才晋升 protected 段
+ * 冷扫描只会在 probation 段内轮转, 不会冲刷热数据
+ */
+
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace levidb {
+    class BufferPool {
+    public:
+        enum : size_t {
+            kBlockSize = 16 * 1024,
+            kAlignment = 4096
+        };
+
+    private:
+        struct Frame {
+            uint64_t key;
+            bool is_protected;
+            std::list<size_t>::iterator pos;
+        };
+
+        char * arena_;
+        std::vector<Frame> frames_;
+        std::vector<size_t> free_;
+        std::list<size_t> probation_;
+        std::list<size_t> protected_;
+        size_t protected_limit_;
+        std::unordered_map<uint64_t, size_t> map_;
+        std::mutex mutex_;
+
+    public:
+        explicit BufferPool(size_t capacity);
+
+        ~BufferPool();
+
+        BufferPool(const BufferPool &) = delete;
+
+        BufferPool & operator=(const BufferPool &) = delete;
+
+    public:
+        // 命中则拷贝 block 内 [offset, offset + n) 至 scratch
+        bool Lookup(size_t seq, size_t block, size_t offset, size_t n, char * scratch);
+
+        // data 必须是完整的 block
+        void Insert(size_t seq, size_t block, const char * data);
+
+    private:
+        static uint64_t Key(size_t seq, size_t block) {
+            return (static_cast<uint64_t>(seq) << 32) | block;
+        }
+
+        char * FrameData(size_t idx) {
+            return arena_ + idx * kBlockSize;
+        }
+    };
+}
+
+#endif //LEVIDB_BUFFER_POOL_H
@@ -0,0 +1,85 @@
+#include <cassert>
+#include <cstdio>
+
+#include "bulk_loader.h"
+#include "db_impl.h"
+#include "filename.h"
+#include "index_format.h"
+#include "kv_format.h"
+
+namespace levidb {
+    BulkLoaderImpl::BulkLoaderImpl(DBImpl * db, ConcurrentIndex * index, bool sorted)
+            : db_(db),
+              index_(index),
+              sorted_(sorted),
+              finished_(false),
+              min_seq_(0),
+              seq_(0),
+              shards_(index->ShardCount()) {
+        // 换用新的 Store, 之后的实时写入与导入前的数据可由 seq 区分
+        index_->BeginBulkLoad();
+        try {
+            index_->RetireStore();
+            min_seq_ = index_->MinStoreSeq();
+            NewStore();
+        } catch (...) {
+            index_->EndBulkLoad();
+            throw;
+        }
+    }
+
+    BulkLoaderImpl::~BulkLoaderImpl() {
+        if (!finished_) {
+            store_.reset();
+            for (size_t seq:seqs_) {
+                StoreFilename(seq, 0, true, db_->LevelDirname(0), &backup_);
+                std::remove(backup_.c_str());
+            }
+            index_->EndBulkLoad();
+        }
+    }
+
+    Status BulkLoaderImpl::Add(const Slice & k, const Slice & v) {
+        assert(!finished_);
+        return CheckedWrite(k, v, [&]() {
+            backup_.clear();
+            PutKVHeader(&backup_, k.size(), 0, 0, index_->KeyspaceId(), 0);
+            backup_.append(k.data(), k.size());
+            backup_.append(v.data(), v.size());
+            if (!store_->Reserve(backup_.size())) {
+                NewStore();
+                store_->Reserve(backup_.size()); // 记录长度已检查, 新 Store 总能容纳
+            }
+            size_t id = store_->Add(backup_, false);
+            shards_[index_->ShardOf(k)].emplace_back(k.ToString(),
+                                                     KVRep(static_cast<uint32_t>(seq_), static_cast<uint32_t>(id)),
+                                                     k.size() + v.size());
+        });
+    }
+
+    void BulkLoaderImpl::Finish() {
+        assert(!finished_);
+        store_.reset(); // 刷出缓冲
+        for (size_t seq:seqs_) {
+            db_->manager_.RegisterStore(seq, true);
+        }
+        finished_ = true;
+        try {
+            index_->Ingest(std::move(shards_), sorted_, min_seq_);
+        } catch (...) {
+            index_->EndBulkLoad();
+            throw;
+        }
+        index_->EndBulkLoad();
+    }
+
+    // 不能借用 backup_, Add 换新 Store 时其中还有待写入的记录
+    void BulkLoaderImpl::NewStore() {
+        store_.reset();
+        seq_ = db_->UniqueSeq();
+        seqs_.emplace_back(seq_);
+        std::string fname;
+        StoreFilename(seq_, 0, true, db_->LevelDirname(0), &fname);
+        store_ = Store::OpenForCompressedWrite(fname);
+    }
+}
@@ -0,0 +1,51 @@
+#pragma once
+#ifndef LEVIDB_BULK_LOADER_IMPL_H
+#define LEVIDB_BULK_LOADER_IMPL_H
+
+#include <memory>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "../include/bulk_loader.h"
+#include "store.h"
+
+namespace levidb {
+    class ConcurrentIndex;
+
+    class DBImpl;
+
+    class BulkLoaderImpl : public BulkLoader {
+    private:
+        DBImpl * db_;
+        ConcurrentIndex * index_; // DB 或某个 keyspace 的 index
+        bool sorted_;
+        bool finished_;
+        size_t min_seq_; // 导入开始后的实时写入都在 seq 不小于此值的 Store 中
+
+        std::unique_ptr<Store> store_;
+        size_t seq_;
+        std::vector<size_t> seqs_;
+        std::vector<std::vector<std::tuple<std::string, uint64_t, uint64_t>>> shards_; // (k, token, k + v 的长度)
+        std::string backup_;
+
+    public:
+        BulkLoaderImpl(DBImpl * db, ConcurrentIndex * index, bool sorted);
+
+        ~BulkLoaderImpl() override;
+
+        BulkLoaderImpl(const BulkLoaderImpl &) = delete;
+
+        BulkLoaderImpl & operator=(const BulkLoaderImpl &) = delete;
+
+    public:
+        Status Add(const Slice & k, const Slice & v) override;
+
+        void Finish() override;
+
+    private:
+        void NewStore();
+    };
+}
+
+#endif //LEVIDB_BULK_LOADER_IMPL_H
@@ -1,25 +1,152 @@
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <exception>
+#include <thread>
+
 #include "concurrent_index.h"
 #include "iterator_merger.h"
 
 namespace levidb {
+    void ConcurrentIndex::EnableShardAffinity() {
+        executor_ = std::make_unique<ShardExecutor>(indexes_.size());
+    }
+
+    std::future<bool> ConcurrentIndex::GetAsync(const Slice & k, std::string * out) const {
+        return Dispatch(Hash(k) % indexes_.size(), [k = k.ToString(), out](Index * index) {
+            return index->Get(k, out);
+        });
+    }
+
+    std::future<void> ConcurrentIndex::AddAsync(const Slice & k, const Slice & v, bool overwrite) {
+        return Dispatch(Hash(k) % indexes_.size(), [k = k.ToString(), v = v.ToString(), overwrite](Index * index) {
+            index->Add(k, v, overwrite, 0);
+        });
+    }
+
+    std::future<void> ConcurrentIndex::DelAsync(const Slice & k) {
+        return Dispatch(Hash(k) % indexes_.size(), [k = k.ToString()](Index * index) {
+            index->Del(k);
+        });
+    }
+
     bool ConcurrentIndex::Get(const Slice & k, std::string * v) const {
-        return indexes_[Hash(k) % indexes_.size()]->Get(k, v);
+        return Execute(k, [&](Index * index) { return index->Get(k, v); });
     }
 
     bool ConcurrentIndex::GetInternal(const Slice & k, uint64_t * v) const {
-        return indexes_[Hash(k) % indexes_.size()]->GetInternal(k, v);
+        return Execute(k, [&](Index * index) { return index->GetInternal(k, v); });
     }
 
-    bool ConcurrentIndex::Add(const Slice & k, const Slice & v, bool overwrite) {
-        return indexes_[Hash(k) % indexes_.size()]->Add(k, v, overwrite);
+    bool ConcurrentIndex::Add(const Slice & k, const Slice & v, bool overwrite, uint64_t expire) {
+        return Execute(k, [&](Index * index) { return index->Add(k, v, overwrite, expire); });
     }
 
-    bool ConcurrentIndex::AddInternal(const Slice & k, uint64_t v) {
-        return indexes_[Hash(k) % indexes_.size()]->AddInternal(k, v);
+    bool ConcurrentIndex::AddInternal(const Slice & k, uint64_t v, uint64_t size, size_t min_seq) {
+        return Execute(k, [&](Index * index) { return index->AddInternal(k, v, size, min_seq); });
+    }
+
+    bool ConcurrentIndex::AddBlob(const Slice & k, size_t seq, size_t size) {
+        return Execute(k, [&](Index * index) { return index->AddBlob(k, seq, size); });
+    }
+
+    std::unique_ptr<ValueReader>
+    ConcurrentIndex::GetStream(const Slice & k) const {
+        return Execute(k, [&](Index * index) { return index->GetStream(k); });
     }
 
     bool ConcurrentIndex::Del(const Slice & k) {
-        return indexes_[Hash(k) % indexes_.size()]->Del(k);
+        return Execute(k, [&](Index * index) { return index->Del(k); });
+    }
+
+    void ConcurrentIndex::Merge(const Slice & k, const Slice & operand) {
+        Execute(k, [&](Index * index) { return index->Merge(k, operand); });
+    }
+
+    bool ConcurrentIndex::CompareAndSwap(const Slice & k, const Slice & expected, const Slice & v) {
+        return Execute(k, [&](Index * index) { return index->CompareAndSwap(k, expected, v); });
+    }
+
+    bool ConcurrentIndex::DelExpired(const Slice & k, uint64_t rep) {
+        return Execute(k, [&](Index * index) { return index->DelExpired(k, rep); });
+    }
+
+    size_t ConcurrentIndex::MinStoreSeq() const {
+        size_t result = SIZE_MAX;
+        for (const auto & index:indexes_) {
+            result = std::min(result, index->StoreSeq());
+        }
+        return result;
+    }
+
+    uint64_t ConcurrentIndex::Count() const {
+        uint64_t result = 0;
+        for (const auto & index:indexes_) {
+            result += index->Count();
+        }
+        return result;
+    }
+
+    void ConcurrentIndex::Estimate(const Slice & start, const Slice & limit,
+                                   uint64_t * count, uint64_t * bytes) const {
+        *count = 0;
+        *bytes = 0;
+        for (const auto & index:indexes_) {
+            uint64_t c;
+            uint64_t b;
+            index->Estimate(start, limit, &c, &b);
+            *count += c;
+            *bytes += b;
+        }
+    }
+
+    void ConcurrentIndex::BeginBulkLoad() {
+        for (auto & index:indexes_) {
+            index->BeginBulkLoad();
+        }
+    }
+
+    void ConcurrentIndex::EndBulkLoad() {
+        for (auto & index:indexes_) {
+            index->EndBulkLoad();
+        }
+    }
+
+    void ConcurrentIndex::Ingest(std::vector<std::vector<std::tuple<std::string, uint64_t, uint64_t>>> && shards,
+                                 bool sorted, size_t min_seq) {
+        assert(shards.size() == indexes_.size());
+        std::vector<std::exception_ptr> errors(shards.size());
+        std::vector<std::thread> jobs;
+        for (size_t i = 0; i < shards.size(); ++i) {
+            jobs.emplace_back([&](size_t nth) {
+                try {
+                    auto & kvs = shards[nth];
+                    // 有序插入时树的路径大多仍在 cache 中
+                    // 排序后同一 key 的记录相邻, token 递增, 只插入最后一次
+                    if (!sorted || !std::is_sorted(kvs.cbegin(), kvs.cend())) {
+                        std::sort(kvs.begin(), kvs.end());
+                    }
+                    for (size_t i = 0; i < kvs.size(); ++i) {
+                        const auto & [k, token, size] = kvs[i];
+                        if (i + 1 < kvs.size() && std::get<0>(kvs[i + 1]) == k) {
+                            continue;
+                        }
+                        indexes_[nth]->AddInternal(k, token, size, min_seq);
+                    }
+                } catch (...) {
+                    errors[nth] = std::current_exception();
+                }
+            }, i);
+        }
+        for (auto & job:jobs) {
+            job.join();
+        }
+        for (const auto & error:errors) {
+            if (error) {
+                std::rethrow_exception(error);
+            }
+        }
     }
 
     std::unique_ptr<Iterator>
@@ -31,6 +158,51 @@ namespace levidb {
         return std::make_unique<IteratorMerger>(std::move(iters));
     }
 
+    // 线程依次领取 shard, shard 数多于线程数时自然均衡
+    void ConcurrentIndex::ParallelScan(size_t num_threads,
+                                       const std::function<bool(const Slice &, const Slice &)> & callback,
+                                       const Slice * begin, const Slice * end) const {
+        std::atomic<size_t> next(0);
+        std::atomic<bool> stop(false);
+        std::vector<std::exception_ptr> errors(indexes_.size());
+        std::vector<std::thread> jobs;
+        num_threads = std::max<size_t>(std::min(num_threads, indexes_.size()), 1);
+        for (size_t i = 0; i < num_threads; ++i) {
+            jobs.emplace_back([&]() {
+                for (size_t nth; !stop && (nth = next.fetch_add(1)) < indexes_.size();) {
+                    try {
+                        auto iter = indexes_[nth]->GetIterator();
+                        if (begin != nullptr) {
+                            iter->Seek(*begin);
+                        } else {
+                            iter->SeekToFirst();
+                        }
+                        for (; !stop && iter->Valid(); iter->Next()) {
+                            Slice k = iter->Key();
+                            if (end != nullptr && !SliceComparator()(k, *end)) {
+                                break;
+                            }
+                            if (!callback(k, iter->Value())) {
+                                stop = true;
+                            }
+                        }
+                    } catch (...) {
+                        errors[nth] = std::current_exception();
+                        stop = true;
+                    }
+                }
+            });
+        }
+        for (auto & job:jobs) {
+            job.join();
+        }
+        for (const auto & error:errors) {
+            if (error) {
+                std::rethrow_exception(error);
+            }
+        }
+    }
+
     void ConcurrentIndex::Sync() {
         for (auto & index:indexes_) {
             index->Sync();
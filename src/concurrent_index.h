@@ -2,14 +2,23 @@
 #ifndef LEVIDB_CONCURRENT_INDEX_H
 #define LEVIDB_CONCURRENT_INDEX_H
 
+#include <functional>
+#include <future>
+#include <optional>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 #include "index.h"
+#include "shard_executor.h"
 
 namespace levidb {
     class ConcurrentIndex {
     private:
         std::vector<std::unique_ptr<Index>> indexes_;
+        std::unique_ptr<ShardExecutor> executor_;
 
         friend class DBImpl;
 
@@ -24,24 +33,104 @@ namespace levidb {
         ConcurrentIndex & operator=(const ConcurrentIndex &) = delete;
 
     public:
+        // 此后按 key 的操作都由 shard 所属的 worker 执行
+        void EnableShardAffinity();
+
+        // k, v 被拷贝; 结果写入 out, out 须存活至 future 就绪
+        std::future<bool> GetAsync(const Slice & k, std::string * out) const;
+
+        std::future<void> AddAsync(const Slice & k, const Slice & v, bool overwrite);
+
+        std::future<void> DelAsync(const Slice & k);
+
         bool Get(const Slice & k, std::string * v) const;
 
         bool GetInternal(const Slice & k, uint64_t * v) const;
 
-        bool Add(const Slice & k, const Slice & v, bool overwrite);
+        bool Add(const Slice & k, const Slice & v, bool overwrite, uint64_t expire);
+
+        bool AddInternal(const Slice & k, uint64_t v, uint64_t size, size_t min_seq);
 
-        bool AddInternal(const Slice & k, uint64_t v);
+        bool AddBlob(const Slice & k, size_t seq, size_t size);
+
+        std::unique_ptr<ValueReader>
+        GetStream(const Slice & k) const;
 
         bool Del(const Slice & k);
 
+        void Merge(const Slice & k, const Slice & operand);
+
+        bool CompareAndSwap(const Slice & k, const Slice & expected, const Slice & v);
+
+        bool DelExpired(const Slice & k, uint64_t rep);
+
+        // 各 shard 正在写入的 Store 中最小的 seq
+        size_t MinStoreSeq() const;
+
+        uint64_t Count() const;
+
+        void Estimate(const Slice & start, const Slice & limit, uint64_t * count, uint64_t * bytes) const;
+
+        size_t ShardOf(const Slice & k) const { return Hash(k) % indexes_.size(); }
+
+        size_t ShardCount() const { return indexes_.size(); }
+
+        uint32_t KeyspaceId() const { return indexes_.front()->KeyspaceId(); }
+
+        void BeginBulkLoad();
+
+        void EndBulkLoad();
+
+        // shards[i] 中的 (k, token, size) 由一个线程并入第 i 个 index, 见 Index::AddInternal
+        void Ingest(std::vector<std::vector<std::tuple<std::string, uint64_t, uint64_t>>> && shards, bool sorted,
+                    size_t min_seq);
+
         std::unique_ptr<Iterator>
         GetIterator() const;
 
+        void ParallelScan(size_t num_threads, const std::function<bool(const Slice &, const Slice &)> & callback,
+                          const Slice * begin, const Slice * end) const;
+
         void Sync();
 
         void RetireStore();
 
     private:
+        // 未启用 affinity 时在调用线程执行, future 已就绪
+        template<typename F>
+        std::future<std::invoke_result_t<F, Index *>>
+        Dispatch(size_t nth, F && f) const {
+            using R = std::invoke_result_t<F, Index *>;
+            auto task = std::make_shared<std::packaged_task<R()>>(
+                    [index = indexes_[nth].get(), f = std::forward<F>(f)]() mutable { return f(index); });
+            std::future<R> future = task->get_future();
+            if (executor_ == nullptr) {
+                (*task)();
+            } else {
+                executor_->Submit(nth, [task]() { (*task)(); });
+            }
+            return future;
+        }
+
+        // 同步调用不经过 future, 结果直接写回调用方栈上
+        template<typename F>
+        std::invoke_result_t<F, Index *>
+        Execute(const Slice & k, F && f) const {
+            using R = std::invoke_result_t<F, Index *>;
+            size_t nth = Hash(k) % indexes_.size();
+            Index * index = indexes_[nth].get();
+            if (executor_ == nullptr) {
+                return f(index);
+            }
+            if constexpr (std::is_void_v<R>) {
+                executor_->Run(nth, [&]() { f(index); });
+            } else {
+                std::optional<R> result;
+                executor_->Run(nth, [&]() { result.emplace(f(index)); });
+                return std::move(*result);
+            }
+        }
+
         static size_t Hash(const Slice & k);
     };
 }
@@ -0,0 +1,29 @@
+#pragma once
+#ifndef LEVIDB_CRC32C_H
+#define LEVIDB_CRC32C_H
+
+/*
+ * CRC32C(SSE4.2 指令)
+ */
+
+#include <cstdint>
+#include <cstring>
+#include <nmmintrin.h>
+
+namespace levidb {
+    inline uint32_t Crc32c(const char * p, size_t n, uint32_t crc = 0) {
+        uint64_t c = ~crc & UINT32_MAX;
+        for (; n >= sizeof(uint64_t); n -= sizeof(uint64_t), p += sizeof(uint64_t)) {
+            uint64_t v;
+            memcpy(&v, p, sizeof(v));
+            c = _mm_crc32_u64(c, v);
+        }
+        auto c32 = static_cast<uint32_t>(c);
+        for (; n > 0; --n, ++p) {
+            c32 = _mm_crc32_u8(c32, static_cast<uint8_t>(*p));
+        }
+        return ~c32;
+    }
+}
+
+#endif //LEVIDB_CRC32C_H
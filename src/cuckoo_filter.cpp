@@ -0,0 +1,182 @@
+#include <cassert>
+#include <utility>
+
+#include "crc32c.h"
+#include "cuckoo_filter.h"
+
+namespace levidb {
+    static constexpr uint32_t kFilterMagic = 0x4c564348; // "LVCH", 旧版存 16bits 指纹, 不再兼容
+
+    // 哈希写入文件, 必须与编译器和标准库无关
+    // FNV-1a 之后以 murmur3 的 fmix64 打散, 低 32 位定位主 bucket, 高 32 位定位备用 bucket
+    static uint64_t FilterHash(const Slice & k) {
+        uint64_t h = 0xcbf29ce484222325;
+        for (size_t i = 0; i < k.size(); ++i) {
+            h ^= static_cast<uint8_t>(k[i]);
+            h *= 0x100000001b3;
+        }
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccd;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53;
+        h ^= h >> 33;
+        return h != 0 ? h : 1; // 0 表示空位
+    }
+
+    CuckooFilter::CuckooFilter(size_t capacity)
+            : count_(0),
+              rnd_(0x9e3779b97f4a7c15) {
+        size_t buckets = 1;
+        while (buckets * kBucketSize < capacity) {
+            buckets <<= 1;
+        }
+        table_.resize(buckets * kBucketSize);
+        mask_ = buckets - 1;
+    }
+
+    void CuckooFilter::Add(const Slice & k) {
+        uint64_t h = FilterHash(k);
+        ++count_;
+        while (!Insert(h)) {
+            Grow();
+        }
+    }
+
+    bool CuckooFilter::MayContain(const Slice & k) const {
+        uint64_t h = FilterHash(k);
+        return FindInBucket(Index(h), h) || FindInBucket(AltIndex(h), h);
+    }
+
+    void CuckooFilter::Del(const Slice & k) {
+        uint64_t h = FilterHash(k);
+        if (DeleteFromBucket(Index(h), h) || DeleteFromBucket(AltIndex(h), h)) {
+            --count_;
+        } else {
+            assert(false);
+        }
+    }
+
+    /*
+     * magic(u32) + crc(u32) + buckets(u64) + count(u64) + table
+     */
+    void CuckooFilter::EncodeTo(std::string * dst) const {
+        std::string body;
+        uint64_t buckets = mask_ + 1;
+        uint64_t count = count_;
+        body.append(reinterpret_cast<const char *>(&buckets), sizeof(buckets));
+        body.append(reinterpret_cast<const char *>(&count), sizeof(count));
+        body.append(reinterpret_cast<const char *>(table_.data()), table_.size() * sizeof(table_[0]));
+
+        uint32_t crc = Crc32c(body.data(), body.size());
+        dst->append(reinterpret_cast<const char *>(&kFilterMagic), sizeof(kFilterMagic));
+        dst->append(reinterpret_cast<const char *>(&crc), sizeof(crc));
+        dst->append(body);
+    }
+
+    bool CuckooFilter::DecodeFrom(const Slice & src) {
+        constexpr size_t kHeaderSize = sizeof(uint32_t) * 2 + sizeof(uint64_t) * 2;
+        if (src.size() < kHeaderSize) {
+            return false;
+        }
+        uint32_t magic;
+        uint32_t crc;
+        const char * p = src.data();
+        memcpy(&magic, p, sizeof(magic));
+        p += sizeof(magic);
+        memcpy(&crc, p, sizeof(crc));
+        p += sizeof(crc);
+        if (magic != kFilterMagic || crc != Crc32c(p, src.size() - (p - src.data()))) {
+            return false;
+        }
+
+        uint64_t buckets;
+        uint64_t count;
+        memcpy(&buckets, p, sizeof(buckets));
+        p += sizeof(buckets);
+        memcpy(&count, p, sizeof(count));
+        p += sizeof(count);
+        if (buckets == 0 || (buckets & (buckets - 1)) != 0 ||
+            src.size() - kHeaderSize != buckets * kBucketSize * sizeof(table_[0])) {
+            return false;
+        }
+
+        table_.resize(buckets * kBucketSize);
+        memcpy(table_.data(), p, table_.size() * sizeof(table_[0]));
+        mask_ = buckets - 1;
+        count_ = count;
+        return true;
+    }
+
+    bool CuckooFilter::Insert(uint64_t & h) {
+        size_t index = Index(h);
+        if (InsertToBucket(index, h) || InsertToBucket(AltIndex(h), h)) {
+            return true;
+        }
+
+        for (int i = 0; i < kMaxKicks; ++i) {
+            rnd_ ^= rnd_ << 13;
+            rnd_ ^= rnd_ >> 7;
+            rnd_ ^= rnd_ << 17;
+            std::swap(h, table_[index * kBucketSize + rnd_ % kBucketSize]);
+            index = Index(h) == index ? AltIndex(h) : Index(h);
+            if (InsertToBucket(index, h)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // 只在内存中重新安置已有的哈希, 不读取 key; 两倍容量仍放不下时继续加倍
+    void CuckooFilter::Grow() {
+        std::vector<uint64_t> hashes;
+        hashes.reserve(count_);
+        for (uint64_t h:table_) {
+            if (h != 0) {
+                hashes.emplace_back(h);
+            }
+        }
+
+        size_t buckets = mask_ + 1;
+        restart:
+        buckets <<= 1;
+        table_.assign(buckets * kBucketSize, 0);
+        mask_ = buckets - 1;
+        for (uint64_t h:hashes) {
+            if (!Insert(h)) {
+                goto restart;
+            }
+        }
+    }
+
+    bool CuckooFilter::InsertToBucket(size_t index, uint64_t h) {
+        uint64_t * bucket = &table_[index * kBucketSize];
+        for (size_t i = 0; i < kBucketSize; ++i) {
+            if (bucket[i] == 0) {
+                bucket[i] = h;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool CuckooFilter::FindInBucket(size_t index, uint64_t h) const {
+        const uint64_t * bucket = &table_[index * kBucketSize];
+        for (size_t i = 0; i < kBucketSize; ++i) {
+            if (bucket[i] == h) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool CuckooFilter::DeleteFromBucket(size_t index, uint64_t h) {
+        uint64_t * bucket = &table_[index * kBucketSize];
+        for (size_t i = 0; i < kBucketSize; ++i) {
+            if (bucket[i] == h) {
+                bucket[i] = 0;
+                return true;
+            }
+        }
+        return false;
+    }
+}
@@ -0,0 +1,68 @@
+#pragma once
+#ifndef LEVIDB_CUCKOO_FILTER_H
+#define LEVIDB_CUCKOO_FILTER_H
+
+/*
+ * Cuckoo Filter
+ * 回答 "一定不存在", 支持删除
+ *
+ * 每个 bucket 4 个槽, 存 key 的 64bits 哈希, 0 表示空位
+ * 槽中保留完整哈希, 踢出失败时在内存中以两倍容量重新安置, 无需再读 key
+ */
+
+#include <cstdint>
+#include <vector>
+
+#include "../include/slice.h"
+
+namespace levidb {
+    class CuckooFilter {
+    private:
+        enum {
+            kBucketSize = 4,
+            kMaxKicks = 500
+        };
+
+        std::vector<uint64_t> table_;
+        size_t mask_;
+        size_t count_;
+        uint64_t rnd_;
+
+    public:
+        explicit CuckooFilter(size_t capacity);
+
+    public:
+        void Add(const Slice & k);
+
+        bool MayContain(const Slice & k) const;
+
+        // k 必须已经 Add 过
+        void Del(const Slice & k);
+
+        size_t size() const { return count_; }
+
+        size_t capacity() const { return table_.size(); }
+
+        void EncodeTo(std::string * dst) const;
+
+        bool DecodeFrom(const Slice & src);
+
+    private:
+        size_t Index(uint64_t h) const { return h & mask_; }
+
+        size_t AltIndex(uint64_t h) const { return (h >> 32) & mask_; }
+
+        // 失败时 h 为最后被踢出的哈希
+        bool Insert(uint64_t & h);
+
+        void Grow();
+
+        bool InsertToBucket(size_t index, uint64_t h);
+
+        bool FindInBucket(size_t index, uint64_t h) const;
+
+        bool DeleteFromBucket(size_t index, uint64_t h);
+    };
+}
+
+#endif //LEVIDB_CUCKOO_FILTER_H
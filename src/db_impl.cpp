@@ -1,9 +1,23 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <exception>
+#include <functional>
+#include <stdexcept>
+#include <sys/stat.h>
 #include <thread>
+#include <unordered_map>
 
 #include "env.h"
 
+#include "blob.h"
+#include "bulk_loader.h"
 #include "db_impl.h"
+#include "file_manifestor.h"
 #include "filename.h"
+#include "index_format.h"
+#include "kv_format.h"
+#include "update_iterator.h"
 
 namespace levidb {
     static constexpr char kAlloc[] = "_alloc";
@@ -11,15 +25,37 @@ namespace levidb {
     static constexpr char kClose[] = "close";
     static constexpr char kHardwareConcurrency[] = "hardware_concurrency";
     static constexpr char kSeq[] = "seq";
+    static constexpr char kKeyspaceId[] = "keyspace_id";
+    static constexpr char kLastKeyspaceId[] = "last_keyspace_id";
+
+    static std::pair<std::string, std::string> Int64Edit(std::string k, int64_t v) {
+        return {std::move(k), std::string(reinterpret_cast<const char *>(&v), sizeof(v))};
+    }
+
+    static std::vector<std::string> LevelDirs(const std::string & name, const OpenOptions & options) {
+        std::vector<std::string> result;
+        for (const auto & path:options.level_paths) {
+            if (path.empty()) {
+                result.emplace_back(name);
+            } else {
+                result.emplace_back(path.back() == '/' ? path : (path + '/'));
+            }
+        }
+        return result;
+    }
 
     DBImpl::DBImpl(const std::string & name,
                    const OpenOptions & options,
                    open_t)
             : name_(name.back() == '/' ? name : (name + '/')),
               options_(options),
+              level_dirs_(LevelDirs(name_, options)),
               stores_(1),
               manager_(this),
               index_(OpenIndexes()) {
+        if (options_.shard_affinity) {
+            index_.EnableShardAffinity();
+        }
     }
 
     DBImpl::DBImpl(const std::string & name,
@@ -27,9 +63,13 @@ namespace levidb {
                    reopen_t)
             : name_(name.back() == '/' ? name : (name + '/')),
               options_(options),
+              level_dirs_(LevelDirs(name_, options)),
               stores_(1),
               manager_(this),
               index_(ReopenIndexes()) {
+        if (options_.shard_affinity) {
+            index_.EnableShardAffinity();
+        }
     }
 
     DBImpl::DBImpl(const std::string & name,
@@ -38,17 +78,29 @@ namespace levidb {
         assert(false);
     }
 
+    // 一次提交, close 标记与 allocator 状态同时生效
     DBImpl::~DBImpl() {
+        std::vector<std::pair<std::string, std::string>> edits;
+        SaveIndexes(index_, name_, &edits);
+        for (const auto & [name, keyspace]:keyspaces_) {
+            SaveIndexes(keyspace->index_, keyspace->dirname_, &edits);
+        }
+        keyspaces_.clear();
+        edits.emplace_back(Int64Edit(kSeq, static_cast<int64_t>(UniqueSeq())));
+        edits.emplace_back(Int64Edit(kClose, 1));
+        options_.manifestor->Commit(edits);
+    }
+
+    void DBImpl::SaveIndexes(const ConcurrentIndex & index, const std::string & dirname,
+                             std::vector<std::pair<std::string, std::string>> * edits) const {
         size_t nth = 0;
         std::string temp;
-        for (const auto & idx:index_.indexes_) {
+        for (const auto & idx:index.indexes_) {
             auto[alloc, recycle] = idx->AllocatorInfo();
-            IndexFilename(nth++, name_, &temp);
-            options_.manifestor->Set(temp + kAlloc, static_cast<int64_t>(alloc));
-            options_.manifestor->Set(temp + kRecycle, recycle);
+            IndexFilename(nth++, dirname, &temp);
+            edits->emplace_back(Int64Edit(temp + kAlloc, static_cast<int64_t>(alloc)));
+            edits->emplace_back(Int64Edit(temp + kRecycle, recycle));
         }
-        options_.manifestor->Set(kSeq, static_cast<int64_t>(UniqueSeq()));
-        options_.manifestor->Set(kClose, 1);
     }
 
     bool DBImpl::Get(const Slice & k, std::string * v) const {
@@ -60,20 +112,322 @@ namespace levidb {
         return index_.GetIterator();
     }
 
-    void DBImpl::Add(const Slice & k, const Slice & v) {
-        index_.Add(k, v, true);
+    void DBImpl::ParallelScan(size_t num_threads, const ScanCallback & callback,
+                              const Slice * begin, const Slice * end) const {
+        index_.ParallelScan(num_threads, callback, begin, end);
+    }
+
+    void DBImpl::PhysicalScan(size_t num_threads, const ScanCallback & callback) const {
+        ScanStores(index_, num_threads, callback);
+    }
+
+    std::unique_ptr<UpdateIterator>
+    DBImpl::GetUpdatesSince(size_t seq, size_t id) const {
+        return std::make_unique<UpdateIteratorImpl>(const_cast<DBImpl *>(this), seq, id, 0);
+    }
+
+    void DBImpl::ScanStores(const ConcurrentIndex & index, size_t num_threads, const ScanCallback & callback) const {
+        std::lock_guard guard(compact_mutex_);
+        std::vector<size_t> seqs = manager_.Stores();
+        std::atomic<size_t> next(0);
+        std::atomic<bool> stop(false);
+        std::vector<std::exception_ptr> errors(seqs.size());
+        std::vector<std::thread> jobs;
+        num_threads = std::max<size_t>(std::min(num_threads, seqs.size()), 1);
+        for (size_t i = 0; i < num_threads; ++i) {
+            jobs.emplace_back([&]() {
+                for (size_t nth; !stop && (nth = next.fetch_add(1)) < seqs.size();) {
+                    try {
+                        if (!ScanStore(index, seqs[nth], callback, stop)) {
+                            stop = true;
+                        }
+                    } catch (...) {
+                        errors[nth] = std::current_exception();
+                        stop = true;
+                    }
+                }
+            });
+        }
+        for (auto & job:jobs) {
+            job.join();
+        }
+        for (const auto & error:errors) {
+            if (error) {
+                std::rethrow_exception(error);
+            }
+        }
+    }
+
+    // 记录的 token 与索引中的一致才是最新版本
+    // 文件名经 manager_ 持锁取得, Store 已被删除时跳过
+    bool DBImpl::ScanStore(const ConcurrentIndex & index, size_t seq,
+                           const ScanCallback & callback, const std::atomic<bool> & stop) const {
+        std::string fname;
+        if (!manager_.GetStoreFilename(seq, &fname)) {
+            return true;
+        }
+        size_t size = penv::Env::Default()->GetFileSize(fname);
+        auto store = Store::OpenForSequentialRead(fname);
+
+        uint64_t now = NowSeconds();
+        std::string buf;
+        std::string value;
+        for (size_t id = 0, next; !stop && id < size; id = next) {
+            buf.clear();
+            next = store->Get(id, &buf);
+            if (next == 0) { // 尾部未写完的记录
+                break;
+            }
+            logream::Slice input(buf);
+            uint32_t k_len;
+            uint32_t flags;
+            uint64_t expire;
+            uint32_t keyspace;
+            uint64_t batch;
+            if (!GetKVHeader(&input, &k_len, &flags, &expire, &keyspace, &batch)
+                || k_len == 0 || IsExpired(expire, now)) {
+                continue;
+            }
+            if (keyspace != 0 && keyspace != index.KeyspaceId()) { // 其他 keyspace 的记录不必查索引
+                continue;
+            }
+            Slice k(input.data(), k_len);
+            uint64_t rep;
+            if (!index.GetInternal(k, &rep) || rep != KVRep(static_cast<uint32_t>(seq), static_cast<uint32_t>(id))) {
+                continue;
+            }
+            bool proceed;
+            if (flags == 0) {
+                proceed = callback(k, {input.data() + k_len, input.size() - k_len});
+            } else if (index.Get(k, &value)) { // 分离的 value, blob 与 merge 链经由索引展开
+                proceed = callback(k, value);
+            } else {
+                continue;
+            }
+            if (!proceed) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    Status DBImpl::Add(const Slice & k, const Slice & v) {
+        return CheckedWrite(k, v, [&]() { index_.Add(k, v, true, 0); });
+    }
+
+    Status DBImpl::Add(const Slice & k, const Slice & v, std::chrono::seconds ttl) {
+        return CheckedWrite(k, v, [&]() {
+            index_.Add(k, v, true, NowSeconds() + std::max<int64_t>(ttl.count(), 0));
+        });
+    }
+
+    Status DBImpl::Del(const Slice & k) {
+        return CheckedWrite(k, {}, [&]() { index_.Del(k); });
+    }
+
+    Status DBImpl::PutIfAbsent(const Slice & k, const Slice & v, bool * inserted) {
+        *inserted = false;
+        return CheckedWrite(k, v, [&]() { *inserted = index_.Add(k, v, false, 0); });
+    }
+
+    Status DBImpl::CompareAndSwap(const Slice & k, const Slice & expected, const Slice & v, bool * swapped) {
+        *swapped = false;
+        return CheckedWrite(k, v, [&]() { *swapped = index_.CompareAndSwap(k, expected, v); });
+    }
+
+    Status DBImpl::Merge(const Slice & k, const Slice & operand) {
+        if (options_.merge_operator == nullptr) {
+            return Status::NotSupported("merge operator not provided");
+        }
+        return CheckedWrite(k, operand, [&]() { index_.Merge(k, operand); });
+    }
+
+    // 整个 batch 在各 shard 的 Store 中一次预留, 总长同样受单条记录的上限约束
+    Status DBImpl::Write(const WriteBatch & batch) {
+        size_t bytes = 0;
+        for (const auto & op:batch.ops_) {
+            Status s = CheckRecord(op.k, op.v);
+            if (!s.Ok()) {
+                return s;
+            }
+            bytes += op.k.size() + op.v.size() + kRecordOverhead;
+        }
+        if (bytes > Store::kMaxRecordSize) {
+            return Status::InvalidArgument("batch too large for a store");
+        }
+        if (batch.ops_.empty()) {
+            return Status::OK();
+        }
+        return ToStatus([&]() { WriteBatchLocked(batch); });
+    }
+
+    // 涉及的 shard 按地址顺序加锁, 两个 batch 之间不会死锁
+    // 记录都带有 batch id, 全部写入后由第一个 shard 追加提交标记, 中途失败的 batch 没有标记
+    void DBImpl::WriteBatchLocked(const WriteBatch & batch) {
+        std::vector<std::pair<Index *, const WriteBatch::Op *>> ops;
+        ops.reserve(batch.ops_.size());
+        for (const auto & op:batch.ops_) {
+            ConcurrentIndex & index = KeyspaceIndex(op.keyspace);
+            ops.emplace_back(index.indexes_[index.ShardOf(op.k)].get(), &op);
+        }
+        std::vector<Index *> shards;
+        shards.reserve(ops.size());
+        for (const auto & [shard, op]:ops) {
+            shards.emplace_back(shard);
+        }
+        std::sort(shards.begin(), shards.end(), std::less<Index *>());
+        shards.erase(std::unique(shards.begin(), shards.end()), shards.end());
+
+        for (Index * shard:shards) {
+            shard->Lock();
+        }
+        std::exception_ptr error;
+        try { // 写入前为每个 shard 预留 index 页与 Store 空间, 预留失败时 batch 不产生任何修改
+            std::vector<std::pair<size_t, size_t>> needs(shards.size());
+            for (const auto & [shard, op]:ops) {
+                auto & [n, bytes] = needs[std::lower_bound(shards.begin(), shards.end(), shard,
+                                                           std::less<Index *>()) - shards.begin()];
+                ++n;
+                bytes += op->k.size() + op->v.size();
+            }
+            ++needs.front().first; // 提交标记
+
+            for (size_t i = 0; i < shards.size(); ++i) {
+                shards[i]->ReserveLocked(needs[i].first, needs[i].second);
+            }
+        } catch (...) {
+            error = std::current_exception();
+        }
+        uint64_t id = UniqueSeq() + 1; // 0 表示不属于 batch
+        for (size_t i = 0; !error && i < ops.size(); ++i) {
+            try {
+                Slice v = ops[i].second->v;
+                ops[i].first->WriteLocked(ops[i].second->k, ops[i].second->del ? nullptr : &v, id);
+            } catch (...) {
+                error = std::current_exception();
+            }
+        }
+        if (!error) {
+            try {
+                shards.front()->CommitLocked(id, ops.size());
+            } catch (...) {
+                error = std::current_exception();
+            }
+        }
+        for (auto it = shards.rbegin(); it != shards.rend(); ++it) {
+            (*it)->Unlock();
+        }
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+
+    ConcurrentIndex & DBImpl::KeyspaceIndex(DB * keyspace) {
+        if (keyspace == this) {
+            return index_;
+        }
+        std::lock_guard guard(keyspaces_mutex_);
+        for (const auto & [name, ks]:keyspaces_) {
+            if (ks.get() == keyspace) {
+                return ks->index_;
+            }
+        }
+        throw std::invalid_argument("keyspace not opened by this DB");
+    }
+
+    Status DBImpl::AddStream(const Slice & k, ValueReader * reader) {
+        return CheckedWrite(k, {}, [&]() {
+            std::string fname;
+            size_t seq = manager_.NewBlob(&fname);
+            try {
+                size_t size = WriteBlob(fname, reader);
+                index_.AddBlob(k, seq, size);
+            } catch (...) { // 未进入索引的 blob 无人引用
+                std::remove(fname.c_str());
+                throw;
+            }
+        });
+    }
+
+    std::unique_ptr<ValueReader>
+    DBImpl::GetStream(const Slice & k) const {
+        return index_.GetStream(k);
+    }
+
+    std::future<bool>
+    DBImpl::GetAsync(const Slice & k, std::string * v) const {
+        return index_.GetAsync(k, v);
+    }
+
+    std::future<void> DBImpl::AddAsync(const Slice & k, const Slice & v) {
+        return index_.AddAsync(k, v, true);
+    }
+
+    std::future<void> DBImpl::DelAsync(const Slice & k) {
+        return index_.DelAsync(k);
+    }
+
+    uint64_t DBImpl::Count() const {
+        return index_.Count();
+    }
+
+    void DBImpl::GetApproximateSizes(const Range * ranges, size_t n, uint64_t * sizes) const {
+        for (size_t i = 0; i < n; ++i) {
+            uint64_t count;
+            index_.Estimate(ranges[i].start, ranges[i].limit, &count, &sizes[i]);
+        }
+    }
+
+    void DBImpl::GetApproximateCount(const Range * ranges, size_t n, uint64_t * counts) const {
+        for (size_t i = 0; i < n; ++i) {
+            uint64_t bytes;
+            index_.Estimate(ranges[i].start, ranges[i].limit, &counts[i], &bytes);
+        }
+    }
+
+    std::unique_ptr<BulkLoader>
+    DBImpl::NewBulkLoader(bool sorted) {
+        return std::make_unique<BulkLoaderImpl>(this, &index_, sorted);
+    }
+
+    DB *
+    DBImpl::OpenKeyspace(const std::string & name, const OpenOptions & options) {
+        if (name.empty() || name.find('/') != std::string::npos) {
+            throw std::invalid_argument("invalid keyspace name");
+        }
+        std::unique_lock lock(keyspaces_mutex_);
+        keyspaces_cv_.wait(lock, [&]() { return cleaning_keyspaces_.count(name) == 0; });
+        auto it = keyspaces_.find(name);
+        if (it != keyspaces_.cend()) {
+            return it->second.get();
+        }
+        std::string dirname;
+        KeyspaceDirname(name, name_, &dirname);
+        bool reopen = penv::Env::Default()->FileExists(dirname);
+        if (!reopen) {
+            penv::Env::Default()->CreateDir(dirname);
+        }
+        auto keyspace = std::make_unique<KeyspaceImpl>(this, dirname, options, reopen);
+        return keyspaces_.emplace(name, std::move(keyspace)).first->second.get();
     }
 
-    void DBImpl::Del(const Slice & k) {
-        index_.Del(k);
+    std::vector<ConcurrentIndex *> DBImpl::AllIndexes() {
+        std::vector<ConcurrentIndex *> result{&index_};
+        std::lock_guard guard(keyspaces_mutex_);
+        for (const auto & [name, keyspace]:keyspaces_) {
+            result.emplace_back(&keyspace->index_);
+        }
+        return result;
     }
 
     bool DBImpl::Compact() {
+        DropExpiredStores();
+        MigrateStores();
         return false;
     }
 
-    void DBImpl::Sync() {
-        index_.Sync();
+    Status DBImpl::Sync() {
+        return ToStatus([&]() { index_.Sync(); });
     }
 
     size_t DBImpl::GetLv(size_t seq) const {
@@ -101,39 +455,273 @@ namespace levidb {
         return seq_.fetch_add(1);
     }
 
-    void DBImpl::Register(size_t seq) {
+    void DBImpl::Register(size_t seq, bool compress) {
         stores_[0].emplace_back(seq);
+        if (compress) {
+            stores_map_.emplace(seq, StoreInfo{true});
+        }
+    }
+
+    void DBImpl::Relevel(size_t seq, size_t lv) {
+        for (auto & l:stores_) {
+            l.erase(std::remove(l.begin(), l.end(), seq), l.end());
+        }
+        if (stores_.size() <= lv) {
+            stores_.resize(lv + 1);
+        }
+        stores_[lv].emplace_back(seq);
+    }
+
+    void DBImpl::Unregister(size_t seq) {
+        for (auto & l:stores_) {
+            l.erase(std::remove(l.begin(), l.end(), seq), l.end());
+        }
+        stores_map_.erase(seq);
+    }
+
+    size_t DBImpl::MinWritingSeq() {
+        size_t result = SIZE_MAX;
+        for (const ConcurrentIndex * index:AllIndexes()) {
+            result = std::min(result, index->MinStoreSeq());
+        }
+        return result;
+    }
+
+    // Store 按时间先后生成, 其中的 key 记录全部过期后整个文件直接删除, 没有任何重写
+    // Store 由所有 keyspace 共用, 首次需要删除 Store 时, 未打开的 keyspace 以 DB 的 options 临时打开
+    // 用完即关闭, 与 DB 关闭时一样提交 allocator 状态; 期间打开同名 keyspace 的调用等待
+    void DBImpl::DropExpiredStores() {
+        std::lock_guard guard(compact_mutex_);
+        std::vector<std::string> names;
+        std::vector<std::unique_ptr<KeyspaceImpl>> keyspaces;
+        std::vector<ConcurrentIndex *> indexes;
+        std::exception_ptr error;
+        try {
+            size_t min_seq = MinWritingSeq();
+            uint64_t now = NowSeconds();
+            std::vector<std::pair<std::string, size_t>> records;
+            for (size_t seq:manager_.StoresBefore(min_seq)) {
+                auto it = stores_expire_.find(seq);
+                if (it != stores_expire_.cend() && !IsExpired(it->second, now)) {
+                    continue;
+                }
+                records.clear();
+                uint64_t expire = ScanStoreExpire(seq, &records);
+                if (!IsExpired(expire, now)) {
+                    stores_expire_[seq] = expire;
+                    continue;
+                }
+                if (indexes.empty()) {
+                    OpenClosedKeyspaces(&names, &keyspaces);
+                    indexes = AllIndexes();
+                    for (const auto & keyspace:keyspaces) {
+                        indexes.emplace_back(&keyspace->index_);
+                    }
+                }
+                // 仍指向本 Store 的索引项静默移除, 被覆盖的 key 与其他 keyspace 的同名 key 不受影响
+                for (const auto & [k, id]:records) {
+                    uint64_t rep = KVRep(static_cast<uint32_t>(seq), static_cast<uint32_t>(id));
+                    for (ConcurrentIndex * index:indexes) {
+                        index->DelExpired(k, rep);
+                    }
+                }
+                manager_.RemoveStore(seq);
+                stores_expire_.erase(seq);
+            }
+        } catch (...) {
+            error = std::current_exception();
+        }
+
+        try {
+            std::vector<std::pair<std::string, std::string>> edits;
+            for (const auto & keyspace:keyspaces) {
+                SaveIndexes(keyspace->index_, keyspace->dirname_, &edits);
+            }
+            keyspaces.clear();
+            if (!edits.empty()) {
+                options_.manifestor->Commit(edits);
+            }
+        } catch (...) {
+            if (!error) {
+                error = std::current_exception();
+            }
+        }
+        if (!names.empty()) {
+            {
+                std::lock_guard keyspaces_guard(keyspaces_mutex_);
+                for (const auto & name:names) {
+                    cleaning_keyspaces_.erase(name);
+                }
+            }
+            keyspaces_cv_.notify_all();
+        }
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+
+    // 先在 cleaning_keyspaces_ 中登记, 打开失败时 names 中已登记的由调用方移除
+    void DBImpl::OpenClosedKeyspaces(std::vector<std::string> * names,
+                                     std::vector<std::unique_ptr<KeyspaceImpl>> * keyspaces) {
+        {
+            std::vector<std::string> children;
+            penv::Env::Default()->GetChildren(name_, &children);
+            std::lock_guard guard(keyspaces_mutex_);
+            for (const auto & child:children) {
+                if (IsKeyspace(child) && keyspaces_.find(GetKeyspaceName(child)) == keyspaces_.cend()) {
+                    names->emplace_back(GetKeyspaceName(child));
+                    cleaning_keyspaces_.emplace(names->back());
+                }
+            }
+        }
+        OpenOptions options = options_;
+        options.shard_affinity = false;
+        std::string dirname;
+        for (const auto & name:*names) {
+            KeyspaceDirname(name, name_, &dirname);
+            keyspaces->emplace_back(std::make_unique<KeyspaceImpl>(this, dirname, options, true));
+        }
+    }
+
+    // 按文件修改时间判断冷热, 封存后不再写入, mtime 即封存时间
+    void DBImpl::MigrateStores() {
+        if (options_.cold_store_age == 0) {
+            return;
+        }
+        std::lock_guard guard(compact_mutex_);
+        size_t min_seq = MinWritingSeq();
+        auto now = static_cast<int64_t>(NowSeconds());
+        std::string fname;
+        for (size_t seq:manager_.StoresBefore(min_seq)) {
+            size_t lv;
+            if (!manager_.GetStoreFilename(seq, &fname, &lv) || lv != 0) { // stores_ 只能经 manager_ 持锁读取
+                continue;
+            }
+            struct stat st{};
+            if (stat(fname.c_str(), &st) != 0
+                || now - static_cast<int64_t>(st.st_mtime) < static_cast<int64_t>(options_.cold_store_age)) {
+                continue;
+            }
+            manager_.MoveStore(seq, 1);
+        }
+    }
+
+    // stores_ 可能正被新建的 Store 修改, 文件名须经 manager_ 持锁取得, 找不到时保守处理
+    uint64_t DBImpl::ScanStoreExpire(size_t seq, std::vector<std::pair<std::string, size_t>> * records) {
+        std::string fname;
+        if (!manager_.GetStoreFilename(seq, &fname) || IsCompressedStore(fname)) {
+            return UINT64_MAX;
+        }
+        size_t size = penv::Env::Default()->GetFileSize(fname);
+        auto store = Store::OpenForSequentialRead(fname); // 整个文件顺序读一遍, 不经过共享的随机读缓存
+
+        uint64_t result = 0;
+        std::string buf;
+        for (size_t id = 0, next; id < size; id = next) {
+            buf.clear();
+            next = store->Get(id, &buf);
+            if (next == 0) { // 读取失败, 保守处理
+                return UINT64_MAX;
+            }
+            logream::Slice input(buf);
+            uint32_t k_len;
+            uint32_t flags;
+            uint64_t expire;
+            if (!GetKVHeader(&input, &k_len, &flags, &expire)) {
+                return UINT64_MAX;
+            }
+            if (k_len == 0) { // tombstone 与分离的 value 不影响 Store 的去留
+                continue;
+            }
+            if (expire == 0) {
+                return UINT64_MAX;
+            }
+            result = std::max(result, expire);
+            records->emplace_back(std::string(input.data(), k_len), id);
+        }
+        return result;
     }
 
     std::vector<std::unique_ptr<Index>>
     DBImpl::OpenIndexes() {
         LoadOrSetInitInfo();
+        return OpenIndexes(name_, options_);
+    }
+
+    std::vector<std::unique_ptr<Index>>
+    DBImpl::ReopenIndexes() {
+        LoadOrSetInitInfo();
+        return ReopenIndexes(name_, options_);
+    }
+
+    // keyspace 的 id 记录在 "keyspace_ + name/" + kKeyspaceId 下, 从 1 开始分配, 不回收
+    // 早于 id 的 keyspace 在下次打开时补发, 此前写入的记录不带标记, 仍计入 DB 自身
+    uint32_t DBImpl::KeyspaceId(const std::string & dirname) {
+        if (dirname == name_) {
+            return 0;
+        }
+        std::lock_guard guard(keyspace_id_mutex_);
+        std::string k = dirname.substr(name_.size()) + kKeyspaceId;
+        int64_t id;
+        if (!options_.manifestor->Get(k, &id)) {
+            int64_t last = 0;
+            options_.manifestor->Get(kLastKeyspaceId, &last);
+            id = last + 1;
+            options_.manifestor->Commit({Int64Edit(kLastKeyspaceId, id), Int64Edit(std::move(k), id)});
+        }
+        return static_cast<uint32_t>(id);
+    }
+
+    // keyspace 的 shard 数记录在 "keyspace_ + name/" + kHardwareConcurrency 下, DB 自身的不带前缀
+    std::vector<std::unique_ptr<Index>>
+    DBImpl::OpenIndexes(const std::string & dirname, const OpenOptions & options) {
         std::string temp;
         std::vector<std::unique_ptr<Index>> result;
+        uint32_t keyspace = KeyspaceId(dirname);
         int64_t hardware_concurrency = std::thread::hardware_concurrency();
-        options_.manifestor->Set(kHardwareConcurrency, hardware_concurrency);
+        options_.manifestor->Set(dirname.substr(name_.size()) + kHardwareConcurrency, hardware_concurrency);
         for (size_t i = 0; i < hardware_concurrency; ++i) {
-            IndexFilename(i, name_, &temp);
-            result.emplace_back(Index::Open(temp, &manager_));
+            IndexFilename(i, dirname, &temp);
+            result.emplace_back(Index::Open(temp, &manager_, options, keyspace));
         }
         return result;
     }
 
     std::vector<std::unique_ptr<Index>>
-    DBImpl::ReopenIndexes() {
-        LoadOrSetInitInfo();
-        std::string temp;
-        std::vector<std::unique_ptr<Index>> result;
+    DBImpl::ReopenIndexes(const std::string & dirname, const OpenOptions & options) {
+        uint32_t keyspace = KeyspaceId(dirname);
         int64_t hardware_concurrency;
-        options_.manifestor->Get(kHardwareConcurrency, &hardware_concurrency);
-        for (size_t i = 0; i < hardware_concurrency; ++i) {
-            IndexFilename(i, name_, &temp);
-            int64_t alloc;
-            int64_t recycle;
-            options_.manifestor->Get(temp + kAlloc, &alloc);
-            options_.manifestor->Get(temp + kRecycle, &recycle);
-            result.emplace_back(Index::Reopen(temp, &manager_,
-                                              static_cast<size_t>(alloc), recycle));
+        options_.manifestor->Get(dirname.substr(name_.size()) + kHardwareConcurrency, &hardware_concurrency);
+        std::vector<std::string> fnames(static_cast<size_t>(hardware_concurrency));
+        std::vector<std::pair<int64_t, int64_t>> infos(fnames.size());
+        for (size_t i = 0; i < fnames.size(); ++i) {
+            IndexFilename(i, dirname, &fnames[i]);
+            options_.manifestor->Get(fnames[i] + kAlloc, &infos[i].first);
+            options_.manifestor->Get(fnames[i] + kRecycle, &infos[i].second);
+        }
+
+        // mmap 与预热互不依赖, 并行进行
+        std::vector<std::unique_ptr<Index>> result(fnames.size());
+        std::vector<std::exception_ptr> errors(fnames.size());
+        std::vector<std::thread> jobs;
+        for (size_t i = 0; i < fnames.size(); ++i) {
+            jobs.emplace_back([&](size_t nth) {
+                try {
+                    auto[alloc, recycle] = infos[nth];
+                    result[nth] = Index::Reopen(fnames[nth], &manager_, options, keyspace,
+                                                static_cast<size_t>(alloc), recycle);
+                } catch (...) {
+                    errors[nth] = std::current_exception();
+                }
+            }, i);
+        }
+        for (auto & job:jobs) {
+            job.join();
+        }
+        for (const auto & error:errors) {
+            if (error) {
+                std::rethrow_exception(error);
+            }
         }
         return result;
     }
@@ -143,37 +731,83 @@ namespace levidb {
         options_.manifestor->Get(kSeq, &seq);
         seq_.store(static_cast<size_t>(seq));
 
-        std::vector<std::string> children;
-        penv::Env::Default()->GetChildren(name_, &children);
-        for (const auto & child:children) {
-            if (IsStore(child)) {
-                size_t s = GetStoreSeq(child);
-                size_t l = GetStoreLv(child);
-                bool c = IsCompressedStore(child);
-                if (stores_.size() <= l) {
-                    stores_.resize(l + 1);
+        std::vector<std::string> dirs{name_};
+        for (const auto & dir:level_dirs_) {
+            if (std::find(dirs.cbegin(), dirs.cend(), dir) == dirs.cend()) {
+                dirs.emplace_back(dir);
+            }
+        }
+
+        std::unordered_map<size_t, size_t> levels;
+        std::string fname;
+        for (const auto & dir:dirs) {
+            if (!penv::Env::Default()->FileExists(dir)) {
+                penv::Env::Default()->CreateDir(dir);
+            }
+            std::vector<std::string> children;
+            penv::Env::Default()->GetChildren(dir, &children);
+            for (const auto & child:children) {
+                if (IsTempStore(child)) { // 跨设备迁移中断, 源文件仍完整
+                    std::remove((dir + child).c_str());
+                    continue;
                 }
-                stores_[l].emplace_back(s);
-                stores_map_.emplace(s, StoreInfo{c});
+                if (IsStore(child)) {
+                    size_t s = GetStoreSeq(child);
+                    size_t l = GetStoreLv(child);
+                    bool c = IsCompressedStore(child);
+                    if (LevelDirname(l) != dir) {
+                        throw std::runtime_error("store in wrong level path: " + dir + child);
+                    }
+                    auto[it, fresh] = levels.emplace(s, l);
+                    if (!fresh) { // 迁移在删除源文件前中断, 目标文件已完整写入
+                        size_t stale = std::min(it->second, l);
+                        StoreFilename(s, stale, c, LevelDirname(stale), &fname);
+                        std::remove(fname.c_str());
+                        it->second = std::max(it->second, l);
+                        continue;
+                    }
+                    stores_map_.emplace(s, StoreInfo{c});
+                }
+            }
+        }
+        for (const auto & [s, l]:levels) {
+            if (stores_.size() <= l) {
+                stores_.resize(l + 1);
             }
+            stores_[l].emplace_back(s);
         }
     }
 
     std::shared_ptr<DB>
     DB::Open(const std::string & name,
              const OpenOptions & options) {
+        bool exists = penv::Env::Default()->FileExists(name);
+        if (!exists) {
+            penv::Env::Default()->CreateDir(name);
+        }
+        OpenOptions opts = options;
+        std::unique_ptr<Manifestor> manifestor;
+        if (opts.manifestor == nullptr) {
+            std::string fname;
+            ManifestFilename(name.back() == '/' ? name : (name + '/'), &fname);
+            manifestor = std::make_unique<FileManifestor>(fname);
+            opts.manifestor = manifestor.get();
+        }
+
         int64_t close = 0;
-        options.manifestor->Get(kClose, &close);
-        options.manifestor->Set(kClose, 0);
-        if (penv::Env::Default()->FileExists(name)) {
+        opts.manifestor->Get(kClose, &close);
+        opts.manifestor->Set(kClose, 0);
+        std::shared_ptr<DBImpl> db;
+        if (exists) {
             if (close) {
-                return std::make_shared<DBImpl>(name, options, reopen_t());
+                db = std::make_shared<DBImpl>(name, opts, reopen_t());
             } else {
-                return std::make_shared<DBImpl>(name, options, repair_t());
+                db = std::make_shared<DBImpl>(name, opts, repair_t());
             }
         } else {
-            penv::Env::Default()->CreateDir(name);
-            return std::make_shared<DBImpl>(name, options, open_t());
+            db = std::make_shared<DBImpl>(name, opts, open_t());
         }
+        db->manifestor_ = std::move(manifestor);
+        return db;
     }
 }
\ No newline at end of file
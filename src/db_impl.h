@@ -3,15 +3,54 @@
 #define LEVIDB_DB_IMPL_H
 
 #include <atomic>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <set>
+#include <stdexcept>
 
 #include "../include/db.h"
 #include "concurrent_index.h"
+#include "keyspace.h"
+#include "kv_format.h"
 
 namespace levidb {
     struct StoreInfo {
         bool compress;
     };
 
+    // 写接口的异常边界, I/O 失败等内部错误在此转为 Status
+    template<typename F>
+    Status ToStatus(F && f) {
+        try {
+            f();
+            return Status::OK();
+        } catch (const std::invalid_argument & e) {
+            return Status::InvalidArgument(e.what());
+        } catch (const std::length_error & e) {
+            return Status::InvalidArgument(e.what());
+        } catch (const std::exception & e) {
+            return Status::IOError(e.what());
+        }
+    }
+
+    // 写接口入口处检查长度, 超出上限时直接返回 InvalidArgument, 不进入写路径
+    inline Status CheckRecord(const Slice & k, const Slice & v) {
+        if (k.size() > kKeyLenMask) {
+            return Status::InvalidArgument("key too long");
+        }
+        if (k.size() + v.size() > Store::kMaxRecordSize) {
+            return Status::InvalidArgument("record too large for a store");
+        }
+        return Status::OK();
+    }
+
+    template<typename F>
+    Status CheckedWrite(const Slice & k, const Slice & v, F && f) {
+        Status s = CheckRecord(k, v);
+        return s.Ok() ? ToStatus(std::forward<F>(f)) : s;
+    }
+
     struct open_t {
     };
 
@@ -23,16 +62,26 @@ namespace levidb {
 
     class DBImpl : public DB {
     private:
+        std::unique_ptr<Manifestor> manifestor_; // OpenOptions::manifestor 为空时内置, 最后析构
         const std::string name_;
         const OpenOptions options_;
+        const std::vector<std::string> level_dirs_; // 以 '/' 结尾
 
         std::atomic<size_t> seq_;
         std::vector<std::vector<size_t>> stores_;
         std::unordered_map<size_t, StoreInfo> stores_map_;
+        std::unordered_map<size_t, uint64_t> stores_expire_; // 封存的 Store 中最晚的过期时间
+        mutable std::mutex compact_mutex_; // 也防止扫描期间 Store 被删除
 
         StoreManager manager_;
         ConcurrentIndex index_;
 
+        std::map<std::string, std::unique_ptr<KeyspaceImpl>> keyspaces_; // 只增不减, 随 DB 关闭
+        std::set<std::string> cleaning_keyspaces_; // Compact 临时打开的 keyspace, 关闭前 OpenKeyspace 等待
+        mutable std::mutex keyspaces_mutex_;
+        std::mutex keyspace_id_mutex_; // 分配 keyspace id, OpenClosedKeyspaces 不持 keyspaces_mutex_ 打开 keyspace
+        std::condition_variable keyspaces_cv_;
+
     public:
         DBImpl(const std::string & name,
                const OpenOptions & options,
@@ -54,27 +103,85 @@ namespace levidb {
         std::unique_ptr<Iterator>
         GetIterator() const override;
 
-        void Add(const Slice & k, const Slice & v) override;
+        void ParallelScan(size_t num_threads, const ScanCallback & callback,
+                          const Slice * begin, const Slice * end) const override;
+
+        void PhysicalScan(size_t num_threads, const ScanCallback & callback) const override;
+
+        std::unique_ptr<UpdateIterator>
+        GetUpdatesSince(size_t seq, size_t id) const override;
+
+        Status Add(const Slice & k, const Slice & v) override;
+
+        Status Add(const Slice & k, const Slice & v, std::chrono::seconds ttl) override;
+
+        Status Del(const Slice & k) override;
+
+        Status PutIfAbsent(const Slice & k, const Slice & v, bool * inserted) override;
+
+        Status CompareAndSwap(const Slice & k, const Slice & expected, const Slice & v, bool * swapped) override;
+
+        Status Merge(const Slice & k, const Slice & operand) override;
+
+        Status Write(const WriteBatch & batch) override;
 
-        void Del(const Slice & k) override;
+        Status AddStream(const Slice & k, ValueReader * reader) override;
+
+        std::unique_ptr<ValueReader>
+        GetStream(const Slice & k) const override;
+
+        std::future<bool>
+        GetAsync(const Slice & k, std::string * v) const override;
+
+        std::future<void> AddAsync(const Slice & k, const Slice & v) override;
+
+        std::future<void> DelAsync(const Slice & k) override;
+
+        uint64_t Count() const override;
+
+        void GetApproximateSizes(const Range * ranges, size_t n, uint64_t * sizes) const override;
+
+        void GetApproximateCount(const Range * ranges, size_t n, uint64_t * counts) const override;
+
+        std::unique_ptr<BulkLoader>
+        NewBulkLoader(bool sorted) override;
+
+        DB *
+        OpenKeyspace(const std::string & name, const OpenOptions & options) override;
 
         bool Compact() override;
 
-        void Sync() override;
+        Status Sync() override;
 
     private:
         const std::string & GetName() const { return name_; }
 
+        const std::string & LevelDirname(size_t lv) const {
+            return lv < level_dirs_.size() ? level_dirs_[lv] : name_;
+        }
+
         size_t GetLv(size_t seq) const;
 
         bool IsCompressed(size_t seq) const;
 
         size_t UniqueSeq();
 
-        void Register(size_t seq);
+        void Register(size_t seq, bool compress = false);
+
+        void Unregister(size_t seq);
+
+        void Relevel(size_t seq, size_t lv);
 
         friend class StoreManager;
 
+        friend class BulkLoaderImpl;
+
+        friend class KeyspaceImpl;
+
+        friend class UpdateIteratorImpl;
+
+        friend class DB;
+
     private:
         std::vector<std::unique_ptr<Index>>
         OpenIndexes();
@@ -82,7 +189,48 @@ namespace levidb {
         std::vector<std::unique_ptr<Index>>
         ReopenIndexes();
 
+        // 写入记录时所带的 keyspace 标记, DB 自身为 0; keyspace 第一次打开时分配
+        uint32_t KeyspaceId(const std::string & dirname);
+
+        // dirname 为 DB 或 keyspace 的目录
+        std::vector<std::unique_ptr<Index>>
+        OpenIndexes(const std::string & dirname, const OpenOptions & options);
+
+        std::vector<std::unique_ptr<Index>>
+        ReopenIndexes(const std::string & dirname, const OpenOptions & options);
+
+        void SaveIndexes(const ConcurrentIndex & index, const std::string & dirname,
+                         std::vector<std::pair<std::string, std::string>> * edits) const;
+
+        // DB 自身与已打开的全部 keyspace
+        std::vector<ConcurrentIndex *> AllIndexes();
+
+        ConcurrentIndex & KeyspaceIndex(DB * keyspace);
+
+        void WriteBatchLocked(const WriteBatch & batch);
+
         void LoadOrSetInitInfo();
+
+        // 所有 index 正在写入的 Store 中最小的 seq, 更早的 Store 不会再被写入
+        size_t MinWritingSeq();
+
+        void DropExpiredStores();
+
+        // 以 DB 的 options 打开尚未打开的 keyspace, 不加入 keyspaces_
+        void OpenClosedKeyspaces(std::vector<std::string> * names,
+                                 std::vector<std::unique_ptr<KeyspaceImpl>> * keyspaces);
+
+        void MigrateStores();
+
+        // 返回 Store 中 key 记录最晚的过期时间, 有永不过期的记录时为 UINT64_MAX
+        uint64_t ScanStoreExpire(size_t seq, std::vector<std::pair<std::string, size_t>> * records);
+
+        // 只回调仍被 index 引用的记录, 其他 keyspace 的记录被跳过
+        void ScanStores(const ConcurrentIndex & index, size_t num_threads, const ScanCallback & callback) const;
+
+        // 返回 false 表示 callback 要求停止
+        bool ScanStore(const ConcurrentIndex & index, size_t seq,
+                       const ScanCallback & callback, const std::atomic<bool> & stop) const;
     };
 }
 
@@ -0,0 +1,258 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <unistd.h>
+
+#include "crc32c.h"
+#include "file_manifestor.h"
+
+namespace levidb {
+    static void ThrowErrno() {
+        throw std::runtime_error(strerror(errno));
+    }
+
+    static void PutFixed32(std::string * dst, uint32_t v) {
+        dst->append(reinterpret_cast<const char *>(&v), sizeof(v));
+    }
+
+    static void PutLengthPrefixed(std::string * dst, const Slice & s) {
+        PutFixed32(dst, static_cast<uint32_t>(s.size()));
+        dst->append(s.data(), s.size());
+    }
+
+    // 在 body 之前补上 crc 与 len
+    static std::string SealRecord(const std::string & body) {
+        std::string record;
+        PutFixed32(&record, Crc32c(body.data(), body.size()));
+        PutFixed32(&record, static_cast<uint32_t>(body.size()));
+        record.append(body);
+        return record;
+    }
+
+    static bool GetFixed32(const char ** p, const char * limit, uint32_t * v) {
+        if (static_cast<size_t>(limit - *p) < sizeof(*v)) {
+            return false;
+        }
+        memcpy(v, *p, sizeof(*v));
+        *p += sizeof(*v);
+        return true;
+    }
+
+    static bool GetLengthPrefixed(const char ** p, const char * limit, std::string * s) {
+        uint32_t len;
+        if (!GetFixed32(p, limit, &len) || static_cast<size_t>(limit - *p) < len) {
+            return false;
+        }
+        s->assign(*p, len);
+        *p += len;
+        return true;
+    }
+
+    static bool DecodeBody(const char * p, const char * limit,
+                           std::vector<std::pair<std::string, std::string>> * kvs) {
+        uint32_t n;
+        if (!GetFixed32(&p, limit, &n)) {
+            return false;
+        }
+        for (uint32_t i = 0; i < n; ++i) {
+            kvs->emplace_back();
+            if (!GetLengthPrefixed(&p, limit, &kvs->back().first)
+                || !GetLengthPrefixed(&p, limit, &kvs->back().second)) {
+                return false;
+            }
+        }
+        return p == limit;
+    }
+
+    static void WriteAll(int fd, const std::string & data, size_t offset) {
+        for (size_t n = 0; n < data.size();) {
+            ssize_t r = pwrite(fd, data.data() + n, data.size() - n, static_cast<off_t>(offset + n));
+            if (r < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                ThrowErrno();
+            }
+            n += static_cast<size_t>(r);
+        }
+        if (fdatasync(fd) != 0) {
+            ThrowErrno();
+        }
+    }
+
+    // rename 只有在所在目录落盘后才持久
+    static void SyncDir(const std::string & fname) {
+        size_t pos = fname.rfind('/');
+        std::string dirname = pos == std::string::npos ? "." : fname.substr(0, pos + 1);
+        int fd = open(dirname.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd < 0) {
+            ThrowErrno();
+        }
+        bool success = fsync(fd) == 0;
+        int err = errno;
+        close(fd);
+        if (!success) {
+            errno = err;
+            ThrowErrno();
+        }
+    }
+
+    FileManifestor::FileManifestor(const std::string & fname)
+            : fname_(fname),
+              fd_(open(fname.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644)),
+              size_(0),
+              snapshot_size_(0),
+              dir_dirty_(false) {
+        if (fd_ < 0) {
+            ThrowErrno();
+        }
+        try {
+            Load();
+        } catch (...) {
+            close(fd_);
+            throw;
+        }
+    }
+
+    FileManifestor::~FileManifestor() {
+        close(fd_);
+    }
+
+    void FileManifestor::Set(const Slice & k, const Slice & v) {
+        std::string body;
+        PutFixed32(&body, 1);
+        PutLengthPrefixed(&body, k);
+        PutLengthPrefixed(&body, v);
+
+        std::lock_guard guard(mutex_);
+        Append(SealRecord(body));
+        map_[k.ToString()] = v.ToString();
+        MaybeSnapshot();
+    }
+
+    bool FileManifestor::Get(const Slice & k, std::string * v) const {
+        std::lock_guard guard(mutex_);
+        auto it = map_.find(k);
+        if (it != map_.cend()) {
+            v->assign(it->second);
+            return true;
+        }
+        return false;
+    }
+
+    // 一组修改编码为一条记录, 要么全部生效要么全部丢弃
+    void FileManifestor::Commit(const std::vector<std::pair<std::string, std::string>> & kvs) {
+        std::string body;
+        PutFixed32(&body, static_cast<uint32_t>(kvs.size()));
+        for (const auto & [k, v]:kvs) {
+            PutLengthPrefixed(&body, k);
+            PutLengthPrefixed(&body, v);
+        }
+
+        std::lock_guard guard(mutex_);
+        Append(SealRecord(body));
+        for (const auto & [k, v]:kvs) {
+            map_[k] = v;
+        }
+        MaybeSnapshot();
+    }
+
+    void FileManifestor::Load() {
+        std::string buf;
+        char chunk[64 * 1024];
+        for (ssize_t r; (r = read(fd_, chunk, sizeof(chunk))) != 0;) {
+            if (r < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                ThrowErrno();
+            }
+            buf.append(chunk, static_cast<size_t>(r));
+        }
+
+        const char * p = buf.data();
+        const char * limit = buf.data() + buf.size();
+        std::vector<std::pair<std::string, std::string>> kvs;
+        size_t good = 0;
+        while (true) {
+            uint32_t crc;
+            uint32_t len;
+            if (!GetFixed32(&p, limit, &crc) || !GetFixed32(&p, limit, &len)
+                || static_cast<size_t>(limit - p) < len || crc != Crc32c(p, len)) {
+                break;
+            }
+            kvs.clear();
+            if (!DecodeBody(p, p + len, &kvs)) {
+                break;
+            }
+            for (auto & [k, v]:kvs) {
+                map_[std::move(k)] = std::move(v);
+            }
+            p += len;
+            good = static_cast<size_t>(p - buf.data());
+        }
+
+        if (good != buf.size() && ftruncate(fd_, static_cast<off_t>(good)) != 0) {
+            ThrowErrno();
+        }
+        size_ = good;
+        snapshot_size_ = good;
+    }
+
+    // 目录未落盘时崩溃会回到旧文件, 追加到新文件之前必须先补上
+    void FileManifestor::Append(const std::string & record) {
+        if (dir_dirty_) {
+            SyncDir(fname_);
+            dir_dirty_ = false;
+        }
+        WriteAll(fd_, record, size_);
+        size_ += record.size();
+    }
+
+    // 快照失败时 log 仍然完整, 已提交的修改不受影响, 下次提交时重试
+    void FileManifestor::MaybeSnapshot() {
+        if (size_ > kMinSnapshotSize && size_ > snapshot_size_ * kSnapshotFactor) {
+            try {
+                Snapshot();
+            } catch (const std::runtime_error &) {
+            }
+        }
+    }
+
+    // 先写临时文件再 rename, 任一时刻磁盘上都有完整的 manifest
+    void FileManifestor::Snapshot() {
+        std::string body;
+        PutFixed32(&body, static_cast<uint32_t>(map_.size()));
+        for (const auto & [k, v]:map_) {
+            PutLengthPrefixed(&body, k);
+            PutLengthPrefixed(&body, v);
+        }
+        std::string record = SealRecord(body);
+
+        std::string temp = fname_ + ".tmp";
+        int fd = open(temp.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            ThrowErrno();
+        }
+        try {
+            WriteAll(fd, record, 0);
+        } catch (...) {
+            close(fd);
+            std::remove(temp.c_str());
+            throw;
+        }
+        if (rename(temp.c_str(), fname_.c_str()) != 0) {
+            close(fd);
+            ThrowErrno();
+        }
+        close(fd_);
+        fd_ = fd;
+        size_ = record.size();
+        snapshot_size_ = size_;
+        dir_dirty_ = true;
+        SyncDir(fname_);
+        dir_dirty_ = false;
+    }
+}
@@ -0,0 +1,67 @@
+#pragma once
+#ifndef LEVIDB_FILE_MANIFESTOR_H
+#define LEVIDB_FILE_MANIFESTOR_H
+
+/*
+ * 内置 Manifestor, OpenOptions::manifestor 为空时使用
+ * 所有 key 常驻内存, 修改以带校验的记录追加到 edit log 并立即落盘
+ * log 增长到上次快照的数倍时, 以全部 key 组成的单条记录重写整个文件
+ *
+ * 记录格式: crc(u32) + len(u32) + n(u32) + n * [k_len(u32) + k + v_len(u32) + v]
+ * 尾部不完整或校验失败的记录视为未提交, 打开时截去
+ */
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "../include/manifestor.h"
+
+namespace levidb {
+    class FileManifestor : public Manifestor {
+    private:
+        enum {
+            kMinSnapshotSize = 64 * 1024,
+            kSnapshotFactor = 4
+        };
+
+        const std::string fname_;
+        int fd_;
+        size_t size_;
+        size_t snapshot_size_;
+        bool dir_dirty_; // 快照 rename 后目录尚未落盘
+        std::map<std::string, std::string, SliceComparator> map_;
+        mutable std::mutex mutex_;
+
+    public:
+        explicit FileManifestor(const std::string & fname);
+
+        ~FileManifestor() override;
+
+        FileManifestor(const FileManifestor &) = delete;
+
+        FileManifestor & operator=(const FileManifestor &) = delete;
+
+    public:
+        void Set(const Slice & k, const Slice & v) override;
+
+        bool Get(const Slice & k, std::string * v) const override;
+
+        void Commit(const std::vector<std::pair<std::string, std::string>> & kvs) override;
+
+    private:
+        void Load();
+
+        // 调用方持有 mutex_
+        void Append(const std::string & record);
+
+        // 调用方持有 mutex_, 且修改已进入 map_
+        void MaybeSnapshot();
+
+        void Snapshot();
+    };
+}
+
+#endif //LEVIDB_FILE_MANIFESTOR_H
@@ -49,6 +49,40 @@ namespace levidb {
                           kStorePrefix);
     }
 
+    static constexpr char kTempStorePrefix[] = "tmp_store_";
+
+    bool IsTempStore(const std::string & fname) {
+        auto filename = GetFilename(fname);
+        return filename.size() >= sizeof(kTempStorePrefix) &&
+               std::equal(filename.cbegin(), filename.cbegin() + (sizeof(kTempStorePrefix) - 1),
+                          kTempStorePrefix);
+    }
+
+    void TempStoreFilename(const std::string & store_fname, const std::string & dirname,
+                           std::string * fname) {
+        fname->assign(dirname);
+        fname->append("tmp_");
+        fname->append(GetFilename(store_fname));
+    }
+
+    static constexpr char kBlobPrefix[] = "blob_";
+
+    bool IsBlob(const std::string & fname) {
+        auto filename = GetFilename(fname);
+        return filename.size() >= sizeof(kBlobPrefix) &&
+               std::equal(filename.cbegin(), filename.cbegin() + (sizeof(kBlobPrefix) - 1),
+                          kBlobPrefix);
+    }
+
+    static constexpr char kKeyspacePrefix[] = "keyspace_";
+
+    bool IsKeyspace(const std::string & fname) {
+        auto filename = GetFilename(fname);
+        return filename.size() >= sizeof(kKeyspacePrefix) &&
+               std::equal(filename.cbegin(), filename.cbegin() + (sizeof(kKeyspacePrefix) - 1),
+                          kKeyspacePrefix);
+    }
+
     size_t GetStoreSeq(const std::string & fname) {
         assert(IsStore(fname));
         auto filename = GetFilename(fname);
@@ -67,6 +101,12 @@ namespace levidb {
         return strtoull(begin, &end, 10);
     }
 
+    std::string GetKeyspaceName(const std::string & fname) {
+        assert(IsKeyspace(fname));
+        auto filename = GetFilename(fname);
+        return std::string(filename.substr(sizeof(kKeyspacePrefix) - 1));
+    }
+
     void IndexFilename(size_t nth, const std::string & dirname,
                        std::string * fname) {
         char buf[128];
@@ -76,6 +116,21 @@ namespace levidb {
         assert(IsIndex(*fname));
     }
 
+    static constexpr char kFilterSuffix[] = ".filter";
+    static constexpr char kStatsSuffix[] = ".stats";
+
+    void FilterFilename(const std::string & index_fname, std::string * fname) {
+        assert(IsIndex(index_fname));
+        fname->assign(index_fname);
+        fname->append(kFilterSuffix);
+    }
+
+    void StatsFilename(const std::string & index_fname, std::string * fname) {
+        assert(IsIndex(index_fname));
+        fname->assign(index_fname);
+        fname->append(kStatsSuffix);
+    }
+
     void StoreFilename(size_t seq, size_t lv, bool compress, const std::string & dirname,
                        std::string * fname) {
         char buf[128];
@@ -85,4 +140,28 @@ namespace levidb {
         fname->append(buf, static_cast<size_t>(n));
         assert(IsCompressedStore(*fname) || IsPlainStore(*fname));
     }
+
+    void BlobFilename(size_t seq, const std::string & dirname,
+                      std::string * fname) {
+        char buf[128];
+        int n = snprintf(buf, sizeof(buf), "blob_%zu", seq);
+        fname->assign(dirname);
+        fname->append(buf, static_cast<size_t>(n));
+        assert(IsBlob(*fname));
+    }
+
+    static constexpr char kManifestFilename[] = "MANIFEST";
+
+    void ManifestFilename(const std::string & dirname, std::string * fname) {
+        fname->assign(dirname);
+        fname->append(kManifestFilename);
+    }
+
+    void KeyspaceDirname(const std::string & name, const std::string & dirname,
+                         std::string * fname) {
+        fname->assign(dirname);
+        fname->append(kKeyspacePrefix);
+        fname->append(name);
+        fname->push_back('/');
+    }
 }
\ No newline at end of file
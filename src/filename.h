@@ -4,7 +4,13 @@
 
 /*
  * Index 命名规则 index_ + [0, 1, 2, 3, ...]
+ * Filter 命名规则 Index 文件名 + .filter
+ * Stats 命名规则 Index 文件名 + .stats
+ * Blob 命名规则 blob_ + seq(与 Store 共用)
  * Store 命名规则 store_ + seq + _ + lv + [.cprs, .plain]
+ * 跨设备迁移中的 Store 命名规则 tmp_ + Store 文件名
+ * Manifest 文件名 MANIFEST(内置 Manifestor)
+ * Keyspace 目录命名规则 keyspace_ + name, 其中只有 index 文件
  */
 
 #include <string>
@@ -18,15 +24,39 @@ namespace levidb {
 
     bool IsStore(const std::string & fname);
 
+    bool IsTempStore(const std::string & fname);
+
+    bool IsBlob(const std::string & fname);
+
+    bool IsKeyspace(const std::string & fname);
+
     size_t GetStoreSeq(const std::string & fname);
 
     size_t GetStoreLv(const std::string & fname);
 
+    void TempStoreFilename(const std::string & store_fname, const std::string & dirname,
+                           std::string * fname);
+
+    std::string GetKeyspaceName(const std::string & fname);
+
     void IndexFilename(size_t nth, const std::string & dirname,
                        std::string * fname);
 
+    void FilterFilename(const std::string & index_fname, std::string * fname);
+
+    void StatsFilename(const std::string & index_fname, std::string * fname);
+
     void StoreFilename(size_t seq, size_t lv, bool compress, const std::string & dirname,
                        std::string * fname);
+
+    void BlobFilename(size_t seq, const std::string & dirname,
+                      std::string * fname);
+
+    void ManifestFilename(const std::string & dirname, std::string * fname);
+
+    // 以 '/' 结尾
+    void KeyspaceDirname(const std::string & name, const std::string & dirname,
+                         std::string * fname);
 }
 
 #endif //LEVIDB_FILENAME_H
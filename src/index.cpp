@@ -1,20 +1,32 @@
 /*
  * token(64bits) = sign(1bit) + seq(31bits) + padding(1bit) + id(31bits)
- * kv = k_len(varint32) + k(char[]) + v(char[])
- * k_len == 0 -> del
+ * kv 格式见 kv_format.h
  *
  * sign == 0 -> kv
  *      == 1 -> node(offset/kPageSize)
  */
 
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+#include <set>
+#include <sys/mman.h>
+
 #include "coding.h"
 #include "env.h"
 #include "sig_tree_impl.h"
 #include "sig_tree_iter_impl.h"
 #include "sig_tree_node_impl.h"
 
+#include "blob.h"
+#include "cuckoo_filter.h"
+#include "filename.h"
 #include "index.h"
+#include "index_file.h"
 #include "index_format.h"
+#include "index_stats.h"
+#include "kv_format.h"
 
 namespace levidb {
     class Helper;
@@ -26,13 +38,19 @@ namespace levidb {
         Helper * helper_;
         uint64_t & rep_;
         uint32_t k_len_;
+        uint32_t flags_;
+        uint64_t expire_;
         logream::Slice s_;
 
+        friend class IndexImpl;
+
     public:
         KVTrans(Helper * helper, uint64_t & rep)
                 : helper_(helper),
                   rep_(rep),
-                  k_len_(0) {}
+                  k_len_(0),
+                  flags_(0),
+                  expire_(0) {}
 
     public:
         bool operator==(const sgt::Slice & k) const {
@@ -46,6 +64,11 @@ namespace levidb {
             return {s_.data(), k_len_};
         }
 
+        bool Expired() const {
+            Key();
+            return IsExpired(expire_, NowSeconds());
+        }
+
         bool Get(const sgt::Slice & k, std::string * v) const {
             if (reinterpret_cast<uintptr_t>(v) % 2 == 1) { // internal backdoor
                 auto * p = reinterpret_cast<uint64_t *>(reinterpret_cast<char *>(v) - 1);
@@ -68,7 +91,14 @@ namespace levidb {
             }
 
             if (operator==(k)) {
-                v->assign(s_.data() + k_len_, s_.size() - k_len_);
+                if (IsExpired(expire_, NowSeconds())) {
+                    return false;
+                }
+                if (flags_ & (kSeparated | kBlob | kMerge)) {
+                    LoadValue(v);
+                } else {
+                    v->assign(s_.data() + k_len_, s_.size() - k_len_);
+                }
                 return true;
             } else {
                 return false;
@@ -77,18 +107,34 @@ namespace levidb {
 
     private:
         void LoadKV();
+
+        void LoadValue(std::string * v) const;
     };
 
     class Helper : public sgt::SignatureTreeTpl<KVTrans>::Helper {
     private:
         IndexImpl * index_;
         std::string backup_;
+        uint32_t flags_;
+        uint64_t write_expire_; // 只由写路径设置, LoadKV 不修改
+        uint64_t write_batch_; // 同上, WriteLocked 之外为 0
+        uint64_t token_; // 不为 UINT64_MAX 时 Add 不写 Store, 直接返回该 token
+        bool quiet_;
 
         friend class KVTrans;
 
+        friend class IndexImpl;
+
+        friend class IteratorImpl;
+
     public:
         explicit Helper(IndexImpl * index)
-                : index_(index) {}
+                : index_(index),
+                  flags_(0),
+                  write_expire_(0),
+                  write_batch_(0),
+                  token_(UINT64_MAX),
+                  quiet_(false) {}
 
         ~Helper() override = default;
 
@@ -97,6 +143,11 @@ namespace levidb {
 
         void Del(KVTrans & trans) override;
 
+    private:
+        // 写入 backup_, 返回其 token
+        uint64_t Append();
+
+    public:
         uint64_t Pack(size_t offset) const override {
             return NodeRep(offset);
         }
@@ -120,26 +171,30 @@ namespace levidb {
 
     class Allocator : public sgt::Allocator {
     private:
-        std::unique_ptr<penv::MmapFile> file_;
+        enum {
+            kHeadroomPages = 8 // 单次写操作最多分配的页数(估计值)
+        };
+
+        std::unique_ptr<IndexFile> file_;
         size_t alloc_;
         int64_t recycle_;
 
         friend class IndexImpl;
 
     public:
-        explicit Allocator(std::unique_ptr<penv::MmapFile> && file)
+        explicit Allocator(std::unique_ptr<IndexFile> && file)
                 : file_(std::move(file)),
                   alloc_(0),
                   recycle_(-1) {
-            file_->Hint(penv::MmapFile::RANDOM);
+            file_->Hint(IndexFile::RANDOM);
         }
 
-        Allocator(std::unique_ptr<penv::MmapFile> && file,
+        Allocator(std::unique_ptr<IndexFile> && file,
                   size_t alloc, int64_t recycle)
                 : file_(std::move(file)),
                   alloc_(alloc),
                   recycle_(recycle) {
-            file_->Hint(penv::MmapFile::RANDOM);
+            file_->Hint(IndexFile::RANDOM);
         }
 
         ~Allocator() override = default;
@@ -161,7 +216,7 @@ namespace levidb {
             } else {
                 offset = alloc_;
                 size_t occupy = offset + sgt::kPageSize;
-                if (occupy > file_->GetFileSize()) {
+                if (occupy > file_->GetFileSize()) { // EnsureHeadroom 估计不足时的兜底, 由 sgt 调用 Grow 后重试
                     throw sgt::AllocatorFullException();
                 } else {
                     alloc_ = occupy;
@@ -176,20 +231,103 @@ namespace levidb {
         }
 
         void Grow() override {
-            file_->Resize(file_->GetFileSize() * 2);
+            file_->Grow();
+        }
+
+    public:
+        // 写操作之前调用, Grow 可能搬迁映射, 不能发生在树操作中途
+        // ops 次写操作按最坏的一次 kHeadroomPages 加其余每次一页估计
+        void EnsureHeadroom(size_t ops = 1) {
+            while (alloc_ + (kHeadroomPages + ops - 1) * sgt::kPageSize > file_->GetFileSize()) {
+                file_->Grow();
+            }
+        }
+
+        void AdviseHugePages() {
+            file_->Hint(IndexFile::HUGEPAGE);
+        }
+
+        // 预读文件头部的 budget 字节; 只有新建后未经分裂与页复用的树, 上层才集中在头部
+        // 之后的上层散布在整个文件中, 预热只是让已分配区域的前缀驻留内存
+        void Warmup(size_t budget) {
+            size_t n = std::min({budget, alloc_, file_->GetFileSize()});
+            if (n == 0) {
+                return;
+            }
+            madvise(Base(), n, MADV_WILLNEED);
+            const volatile char * p = reinterpret_cast<const char *>(Base());
+            for (size_t i = 0; i < n; i += sgt::kPageSize) {
+                p[i];
+            }
         }
     };
 
     class IndexImpl : public Index {
     private:
+        enum {
+            kFilterInitCapacity = 64 * 1024,
+            kMaxMergeDepth = 16, // merge 链达到此长度时折叠为完整的 value
+        };
+
+        /*
+         * Flat Combining
+         * 写者把操作压入无锁栈, 拿到锁的线程一次性执行栈中所有操作
+         * 同一批内按 key 排序, 连续覆盖同一 key 的 Add 只执行最后一个
+         * 无条件覆盖的 Add 先一次性追加到 Store, 再按 key 的顺序写树
+         */
+        struct WriteOp {
+            enum Type {
+                kAdd,
+                kDel,
+                kMerge,
+                kCas,
+            };
+
+            Type type;
+            Slice k;
+            Slice v;
+            Slice expected; // kCas
+            bool overwrite;
+            uint32_t flags;
+            uint64_t expire;
+            uint64_t token; // 已预先追加时为记录的 token, 否则为 UINT64_MAX
+            bool result;
+            std::exception_ptr error;
+            std::atomic<bool> done;
+            WriteOp * next;
+
+            WriteOp(Type type, const Slice & k, const Slice & v, bool overwrite, uint32_t flags, uint64_t expire)
+                    : type(type), k(k), v(v), overwrite(overwrite), flags(flags), expire(expire),
+                      token(UINT64_MAX), result(false), done(false), next(nullptr) {}
+
+            // 紧随其后的 Add 会覆盖它
+            bool Superseded(const WriteOp * next) const {
+                return next != nullptr && next->k == k
+                       && type == kAdd && overwrite
+                       && next->type == kAdd && next->overwrite;
+            }
+        };
+
         Helper helper_;
         Allocator allocator_;
         sgt::SignatureTreeTpl<KVTrans> tree_;
+        std::unique_ptr<CuckooFilter> filter_;
+        std::string filter_fname_;
+        IndexStats stats_;
+        std::string stats_fname_;
 
         StoreManager * manager_;
         size_t seq_;
         std::shared_ptr<Store> curr_;
+        const uint32_t keyspace_;
+        size_t separate_threshold_;
+        const MergeOperator * merge_operator_;
+        size_t store_budget_; // ReserveLocked 在 curr_ 中预留而尚未用掉的字节数
+        std::vector<size_t> dropped_blobs_; // 当前写操作中不再被引用的 blob, 操作成功后删除
+        size_t bulk_loads_; // 进行中的 BulkLoader 数
+        std::set<std::string, SliceComparator> bulk_deleted_; // 导入期间删除的 key, 导入时不再插入
         mutable std::mutex mutex_;
+        std::atomic<WriteOp *> pending_;
 
         friend class KVTrans;
 
@@ -198,68 +336,263 @@ namespace levidb {
         friend class IteratorImpl;
 
     public:
-        IndexImpl(std::unique_ptr<penv::MmapFile> && file, StoreManager * manager)
+        IndexImpl(const std::string & fname, StoreManager * manager,
+                  const OpenOptions & options, uint32_t keyspace)
                 : helper_(this),
-                  allocator_(std::move(file)),
+                  allocator_(IndexFile::Open(fname, options.index_reserve_size)),
                   tree_(&helper_, &allocator_),
                   manager_(manager),
                   seq_(),
-                  curr_(manager->OpenStoreForReadWrite(&seq_, nullptr)) {};
+                  curr_(manager->OpenStoreForReadWrite(&seq_, nullptr)),
+                  keyspace_(keyspace),
+                  separate_threshold_(options.value_separate_threshold),
+                  merge_operator_(options.merge_operator),
+                  store_budget_(0),
+                  bulk_loads_(0),
+                  pending_(nullptr) {
+            if (options.index_huge_pages) {
+                allocator_.AdviseHugePages();
+            }
+            FilterFilename(fname, &filter_fname_);
+            std::remove(filter_fname_.c_str());
+            if (options.lookup_filter) {
+                filter_ = std::make_unique<CuckooFilter>(kFilterInitCapacity);
+            }
+            StatsFilename(fname, &stats_fname_);
+            std::remove(stats_fname_.c_str());
+        };
 
-        IndexImpl(std::unique_ptr<penv::MmapFile> && file, StoreManager * manager,
+        IndexImpl(const std::string & fname, StoreManager * manager,
+                  const OpenOptions & options, uint32_t keyspace,
                   size_t alloc, int64_t recycle)
                 : helper_(this),
-                  allocator_(std::move(file), alloc, recycle),
+                  allocator_(IndexFile::Reopen(fname, options.index_reserve_size), alloc, recycle),
                   tree_(&helper_, &allocator_, 0),
                   manager_(manager),
                   seq_(),
-                  curr_(manager->OpenStoreForReadWrite(&seq_, nullptr)) {};
+                  curr_(manager->OpenStoreForReadWrite(&seq_, nullptr)),
+                  keyspace_(keyspace),
+                  separate_threshold_(options.value_separate_threshold),
+                  merge_operator_(options.merge_operator),
+                  store_budget_(0),
+                  bulk_loads_(0),
+                  pending_(nullptr) {
+            if (options.index_huge_pages) {
+                allocator_.AdviseHugePages();
+            }
+            allocator_.Warmup(options.index_warmup_size);
+            // filter 与 stats 文件只在正常关闭时写出, 读入后立即删除, 防止异常退出后用到过期的内容
+            FilterFilename(fname, &filter_fname_);
+            StatsFilename(fname, &stats_fname_);
+            LoadStats(); // 先于 filter, 重建 filter 时以其中的 key 数预留容量
+            std::remove(stats_fname_.c_str());
+            if (options.lookup_filter) {
+                LoadFilter();
+            }
+            std::remove(filter_fname_.c_str());
+        };
 
-        ~IndexImpl() override = default;
+        ~IndexImpl() override {
+            if (filter_ != nullptr) {
+                SaveFilter();
+            }
+            SaveStats();
+        }
 
     public:
         bool Get(const Slice & k, std::string * v) const override {
             std::lock_guard guard(mutex_);
+            if (filter_ != nullptr && !filter_->MayContain(k)) {
+                return false;
+            }
             return tree_.Get(k, v);
         }
 
         bool GetInternal(const Slice & k, uint64_t * v) const override {
             std::lock_guard guard(mutex_);
+            if (filter_ != nullptr && !filter_->MayContain(k)) {
+                return false;
+            }
             *v = UINT64_MAX;
             return tree_.Get(k, reinterpret_cast<std::string *>(reinterpret_cast<char *>(v) + 1));
         }
 
-        bool Add(const Slice & k, const Slice & v, bool overwrite) override {
+        bool Add(const Slice & k, const Slice & v, bool overwrite, uint64_t expire) override {
+            CheckKeyLength(k.size());
+            WriteOp op(WriteOp::kAdd, k, v, overwrite, 0, expire);
+            return Submit(&op);
+        }
+
+        bool AddBlob(const Slice & k, size_t seq, size_t size) override {
+            CheckKeyLength(k.size());
+            std::string ref;
+            PutFixed64(&ref, seq);
+            PutFixed64(&ref, size);
+            WriteOp op(WriteOp::kAdd, k, ref, true, kBlob, 0);
+            return Submit(&op);
+        }
+
+        std::unique_ptr<ValueReader>
+        GetStream(const Slice & k) const override {
+            std::string buf;
+            logream::Slice input;
+            uint32_t k_len;
+            uint32_t flags;
+            uint64_t expire;
             std::lock_guard guard(mutex_);
-            restart:
+            if (!FindRecord(k, &buf, &input, &k_len, &flags, &expire)) {
+                return nullptr;
+            }
+            if (flags & kBlob) {
+                std::string fname;
+                manager_->BlobFilename(DecodeFixed64(input.data() + k_len), &fname);
+                return OpenBlob(fname, DecodeFixed64(input.data() + k_len + sizeof(uint64_t)));
+            }
+            auto value = LoadValue(input, k_len, flags, &buf);
+            return OpenStringReader({value.data(), value.size()});
+        }
+
+        // 导入开始后写入(所在 Store 的 seq >= min_seq)或删除的 key 以实时写入为准
+        bool AddInternal(const Slice & k, uint64_t v, uint64_t size, size_t min_seq) override {
+            std::lock_guard guard(mutex_);
+            if (bulk_deleted_.find(k) != bulk_deleted_.cend()) {
+                return false;
+            }
+            allocator_.EnsureHeadroom();
+            bool exist = false;
+            helper_.token_ = v;
+            bool success;
             try {
-                return tree_.Add(k, v, [&](KVTrans & trans, uint64_t & rep) -> bool {
-                    if (!overwrite) {
+                success = tree_.Add(k, {}, [&](KVTrans & trans, uint64_t & rep) -> bool {
+                    exist = true;
+                    if (GetKVSeqAndID(rep).first >= min_seq) {
                         return false;
-                    } else {
-                        rep = helper_.Add(k, v);
-                        return true;
                     }
+                    DropBlob(trans);
+                    rep = v;
+                    stats_.OnOverwrite(k, size);
+                    return true;
                 });
-            } catch (const StoreFullException &) {
-                curr_ = manager_->OpenStoreForReadWrite(&seq_, curr_);
-                goto restart;
+            } catch (...) {
+                helper_.token_ = UINT64_MAX;
+                dropped_blobs_.clear();
+                throw;
+            }
+            helper_.token_ = UINT64_MAX;
+            RemoveDroppedBlobs();
+            if (success && !exist) {
+                FilterAdd(k);
+                stats_.OnInsert(k, size);
             }
+            return success;
         }
 
-        bool AddInternal(const Slice & k, uint64_t v) override {
-            std::lock_guard guard(mutex_);
-            return tree_.Get(k, reinterpret_cast<std::string *>(reinterpret_cast<char *>(v) + 1));
+        bool Del(const Slice & k) override {
+            CheckKeyLength(k.size());
+            WriteOp op(WriteOp::kDel, k, {}, false, 0, 0);
+            return Submit(&op);
         }
 
-        bool Del(const Slice & k) override {
+        bool Merge(const Slice & k, const Slice & operand) override {
+            CheckKeyLength(k.size());
+            WriteOp op(WriteOp::kMerge, k, operand, false, 0, 0);
+            return Submit(&op);
+        }
+
+        bool CompareAndSwap(const Slice & k, const Slice & expected, const Slice & v) override {
+            CheckKeyLength(k.size());
+            WriteOp op(WriteOp::kCas, k, v, true, 0, 0);
+            op.expected = expected;
+            return Submit(&op);
+        }
+
+        bool DelExpired(const Slice & k, uint64_t rep) override {
             std::lock_guard guard(mutex_);
-            restart:
+            uint64_t curr = UINT64_MAX;
+            if (!tree_.Get(k, reinterpret_cast<std::string *>(reinterpret_cast<char *>(&curr) + 1))
+                || curr != rep) {
+                return false;
+            }
+            helper_.quiet_ = true;
+            tree_.Del(k);
+            helper_.quiet_ = false;
+            if (filter_ != nullptr) {
+                filter_->Del(k);
+            }
+            stats_.OnDelete(k);
+            return true;
+        }
+
+        // 持锁期间提交的写操作留在 pending_ 中, 解锁后由提交者自行合并执行
+        void Lock() override {
+            mutex_.lock();
+        }
+
+        void Unlock() override {
+            mutex_.unlock();
+        }
+
+        void ReserveLocked(size_t n, size_t bytes) override {
+            allocator_.EnsureHeadroom(n);
+            bytes += n * kRecordOverhead;
+            store_budget_ = 0;
+            ReserveStore(bytes);
+            store_budget_ = bytes;
+        }
+
+        void WriteLocked(const Slice & k, const Slice * v, uint64_t batch) override {
+            allocator_.EnsureHeadroom();
+            helper_.write_batch_ = batch;
             try {
-                return tree_.Del(k);
-            } catch (const StoreFullException &) {
-                curr_ = manager_->OpenStoreForReadWrite(&seq_, curr_);
-                goto restart;
+                if (v != nullptr) {
+                    AddRecord(k, *v, true, 0, 0);
+                } else {
+                    DelRecord(k);
+                }
+            } catch (...) {
+                helper_.write_batch_ = 0;
+                dropped_blobs_.clear();
+                throw;
+            }
+            helper_.write_batch_ = 0;
+            RemoveDroppedBlobs();
+        }
+
+        void CommitLocked(uint64_t batch, size_t n) override {
+            helper_.backup_.clear();
+            PutBatchCommit(&helper_.backup_, batch, static_cast<uint32_t>(n));
+            helper_.Append();
+        }
+
+        uint32_t KeyspaceId() const override {
+            return keyspace_;
+        }
+
+        uint64_t Count() const override {
+            std::lock_guard guard(mutex_);
+            return stats_.Count();
+        }
+
+        void Estimate(const Slice & start, const Slice & limit,
+                      uint64_t * count, uint64_t * bytes) const override {
+            std::lock_guard guard(mutex_);
+            stats_.Estimate(start, limit, count, bytes);
+        }
+
+        size_t StoreSeq() const override {
+            std::lock_guard guard(mutex_);
+            return seq_;
+        }
+
+        void BeginBulkLoad() override {
+            std::lock_guard guard(mutex_);
+            ++bulk_loads_;
+        }
+
+        void EndBulkLoad() override {
+            std::lock_guard guard(mutex_);
+            if (--bulk_loads_ == 0) {
+                bulk_deleted_.clear();
             }
         }
 
@@ -274,12 +607,510 @@ namespace levidb {
         void RetireStore() override {
             std::lock_guard guard(mutex_);
             curr_ = manager_->OpenStoreForReadWrite(&seq_, curr_);
+            store_budget_ = 0;
         }
 
         std::pair<size_t, int64_t>
         AllocatorInfo() const override {
             return {allocator_.alloc_, allocator_.recycle_};
         };
+
+    private:
+        // 等待者阻塞在 mutex_ 上而不是自旋, 拿到锁时操作仍未完成则由自己合并执行
+        bool Submit(WriteOp * op) {
+            op->next = pending_.load(std::memory_order_relaxed);
+            while (!pending_.compare_exchange_weak(op->next, op,
+                                                   std::memory_order_release,
+                                                   std::memory_order_relaxed)) {
+            }
+            if (!op->done.load(std::memory_order_acquire)) {
+                std::lock_guard guard(mutex_);
+                if (!op->done.load(std::memory_order_acquire)) {
+                    Combine(); // 持锁者完成取出的所有操作后才会解锁, 因此 op 一定在 pending_ 中
+                }
+            }
+            if (op->error) {
+                std::rethrow_exception(op->error);
+            }
+            return op->result;
+        }
+
+        // 调用方持有 mutex_, 取出的每个操作都会被标记完成, 失败时带上异常
+        void Combine() {
+            WriteOp * head = pending_.exchange(nullptr, std::memory_order_acquire);
+            std::vector<WriteOp *> ops;
+            try {
+                for (WriteOp * op = head; op != nullptr; op = op->next) {
+                    ops.emplace_back(op);
+                }
+            } catch (...) {
+                std::exception_ptr error = std::current_exception();
+                while (head != nullptr) {
+                    WriteOp * next = head->next;
+                    head->error = error;
+                    head->done.store(true, std::memory_order_release);
+                    head = next;
+                }
+                return;
+            }
+            std::reverse(ops.begin(), ops.end());
+            // 内存不足时 stable_sort 退化为原地归并, 不会抛出
+            std::stable_sort(ops.begin(), ops.end(), [](const WriteOp * a, const WriteOp * b) {
+                return SliceComparator()(a->k, b->k);
+            });
+            try {
+                AppendBatch(ops);
+            } catch (...) { // 退回逐条写入, 错误由各操作自己报告
+            }
+
+            for (size_t i = 0; i < ops.size(); ++i) {
+                WriteOp * op = ops[i];
+                WriteOp * next = i + 1 < ops.size() ? ops[i + 1] : nullptr;
+                try {
+                    if (op->Superseded(next)) {
+                        op->result = true;
+                        if (op->flags & kBlob) { // 这个 blob 从未进入索引
+                            dropped_blobs_.emplace_back(DecodeFixed64(op->v.data()));
+                            RemoveDroppedBlobs();
+                        }
+                    } else {
+                        allocator_.EnsureHeadroom();
+                        helper_.token_ = op->token; // 已追加的记录不再写 Store
+                        switch (op->type) {
+                            case WriteOp::kAdd:
+                                op->result = AddRecord(op->k, op->v, op->overwrite, op->flags, op->expire);
+                                break;
+                            case WriteOp::kDel:
+                                op->result = DelRecord(op->k);
+                                break;
+                            case WriteOp::kMerge:
+                                op->result = MergeRecord(op->k, op->v);
+                                break;
+                            case WriteOp::kCas:
+                                op->result = CasRecord(op->k, op->expected, op->v);
+                                break;
+                        }
+                        helper_.token_ = UINT64_MAX;
+                        RemoveDroppedBlobs();
+                    }
+                } catch (...) {
+                    helper_.token_ = UINT64_MAX;
+                    dropped_blobs_.clear();
+                    op->error = std::current_exception();
+                }
+                op->done.store(true, std::memory_order_release); // 此后不能再访问 op
+            }
+        }
+
+        // 调用方持有 mutex_; 把会执行的无条件 Add 编码后一次追加, token 记入 op->token
+        // 分离的 value 须先得到 token 才能编码 key 记录, 因此有分离的 value 时追加两次
+        // 总长超出单次预留上限的部分留给逐条写入
+        void AppendBatch(const std::vector<WriteOp *> & ops) {
+            std::vector<WriteOp *> batch;
+            size_t bytes = 0;
+            for (size_t i = 0; i < ops.size(); ++i) {
+                WriteOp * op = ops[i];
+                if (op->type != WriteOp::kAdd || !op->overwrite
+                    || op->Superseded(i + 1 < ops.size() ? ops[i + 1] : nullptr)) {
+                    continue;
+                }
+                bytes += op->k.size() + op->v.size() + kRecordOverhead * 2; // 记录头与预留的分帧各按一份计
+                if (bytes > Store::kMaxRecordSize) {
+                    break;
+                }
+                batch.emplace_back(op);
+            }
+            if (batch.empty()) {
+                return;
+            }
+
+            auto separated = [this](const WriteOp * op) {
+                return op->flags == 0 && op->v.size() >= separate_threshold_;
+            };
+            std::string buf;
+            std::vector<size_t> ends;
+            std::vector<uint64_t> value_reps;
+            for (const WriteOp * op:batch) {
+                if (separated(op)) {
+                    PutKVHeader(&buf, 0, kValue);
+                    buf.append(op->v.data(), op->v.size());
+                    ends.emplace_back(buf.size());
+                }
+            }
+            AppendRecords(buf, ends, &value_reps);
+
+            buf.clear();
+            ends.clear();
+            std::vector<uint64_t> reps;
+            for (size_t i = 0, j = 0; i < batch.size(); ++i) {
+                const WriteOp * op = batch[i];
+                if (separated(op)) {
+                    PutKVHeader(&buf, op->k.size(), kSeparated, op->expire, keyspace_, 0);
+                    buf.append(op->k.data(), op->k.size());
+                    PutFixed64(&buf, value_reps[j++]);
+                } else {
+                    PutKVHeader(&buf, op->k.size(), op->flags, op->expire, keyspace_, 0);
+                    buf.append(op->k.data(), op->k.size());
+                    buf.append(op->v.data(), op->v.size());
+                }
+                ends.emplace_back(buf.size());
+            }
+            AppendRecords(buf, ends, &reps);
+            for (size_t i = 0; i < batch.size(); ++i) {
+                batch[i]->token = reps[i];
+            }
+        }
+
+        // buf 中的记录以 ends 分隔
+        void AppendRecords(const std::string & buf, const std::vector<size_t> & ends, std::vector<uint64_t> * reps) {
+            if (ends.empty()) {
+                return;
+            }
+            std::vector<Slice> records;
+            records.reserve(ends.size());
+            for (size_t i = 0, begin = 0; i < ends.size(); begin = ends[i++]) {
+                records.emplace_back(buf.data() + begin, ends[i] - begin);
+            }
+            std::vector<size_t> ids(records.size());
+            ReserveStore(buf.size() + records.size() * kRecordOverhead);
+            curr_->AddBatch(records.data(), records.size(), ids.data());
+            reps->reserve(ids.size());
+            for (size_t id:ids) {
+                reps->emplace_back(KVRep(static_cast<uint32_t>(seq_), static_cast<uint32_t>(id)));
+            }
+        }
+
+        bool AddRecord(const Slice & k, const Slice & v, bool overwrite, uint32_t flags, uint64_t expire) {
+            helper_.flags_ = flags;
+            helper_.write_expire_ = expire;
+            uint64_t size = k.size() + ((flags & kBlob) ? DecodeFixed64(v.data() + sizeof(uint64_t)) : v.size());
+            bool exist = false;
+            bool success = tree_.Add(k, v, [&](KVTrans & trans, uint64_t & rep) -> bool {
+                exist = true;
+                if (!overwrite && !trans.Expired()) { // 已过期的 key 视为不存在
+                    return false;
+                } else {
+                    DropBlob(trans);
+                    rep = helper_.Add(k, v);
+                    stats_.OnOverwrite(k, size);
+                    return true;
+                }
+            });
+            if (success && !exist) {
+                FilterAdd(k);
+                stats_.OnInsert(k, size);
+            }
+            return success;
+        }
+
+        // 新记录链接到旧记录之后, 继承其过期时间
+        bool MergeRecord(const Slice & k, const Slice & operand) {
+            std::string payload;
+            PutFixed64(&payload, UINT64_MAX);
+            PutFixed64(&payload, 1);
+            payload.append(operand.data(), operand.size());
+            helper_.flags_ = kMerge;
+            helper_.write_expire_ = 0;
+            bool exist = false;
+            tree_.Add(k, payload, [&](KVTrans & trans, uint64_t & rep) -> bool {
+                exist = true;
+                if (trans.Expired()) {
+                    rep = helper_.Add(k, payload);
+                    return true;
+                }
+                // trans 指向 helper_.backup_, 之后的 helper_.Add 会覆盖它
+                uint64_t depth = 1;
+                if (trans.flags_ & kMerge) {
+                    depth += DecodeFixed64(trans.s_.data() + trans.k_len_ + sizeof(uint64_t));
+                }
+                helper_.write_expire_ = trans.expire_;
+                if (depth >= kMaxMergeDepth) {
+                    DropBlob(trans); // 折叠后整条链不再被引用
+                    std::string existing;
+                    std::string value;
+                    if (ResolveValue(k, rep, &existing)) {
+                        Slice s = existing;
+                        merge_operator_->Merge(k, &s, operand, &value);
+                    } else {
+                        merge_operator_->Merge(k, nullptr, operand, &value);
+                    }
+                    helper_.flags_ = 0;
+                    rep = helper_.Add(k, value);
+                } else {
+                    std::string chained;
+                    PutFixed64(&chained, rep);
+                    PutFixed64(&chained, depth);
+                    chained.append(operand.data(), operand.size());
+                    rep = helper_.Add(k, chained);
+                }
+                return true;
+            });
+            if (!exist) {
+                FilterAdd(k);
+                stats_.OnInsert(k, k.size() + operand.size());
+            }
+            return true;
+        }
+
+        // 调用方持有 mutex_, 读取与写入之间不会插入其他写者
+        // 新值继承旧记录的过期时间, 与 merge 相同
+        bool CasRecord(const Slice & k, const Slice & expected, const Slice & v) {
+            std::string buf;
+            logream::Slice input;
+            uint32_t k_len;
+            uint32_t flags;
+            uint64_t expire;
+            if (!FindRecord(k, &buf, &input, &k_len, &flags, &expire)) {
+                return false;
+            }
+            auto value = LoadValue(input, k_len, flags, &buf);
+            if (Slice(value.data(), value.size()) != expected) {
+                return false;
+            }
+            return AddRecord(k, v, true, 0, expire);
+        }
+
+        bool DelRecord(const Slice & k) {
+            if (bulk_loads_ != 0) {
+                bulk_deleted_.emplace(k.data(), k.size());
+            }
+            bool success = tree_.Del(k);
+            if (success) {
+                if (filter_ != nullptr) {
+                    filter_->Del(k);
+                }
+                stats_.OnDelete(k);
+            }
+            return success;
+        }
+
+        // 被覆盖或删除的记录引用了 blob(包括 merge 链底部的 blob)时记下其 seq
+        // trans 须已载入, 且尚未被之后的 helper_.Add 覆盖
+        void DropBlob(const KVTrans & trans) {
+            trans.Key();
+            if (trans.flags_ & kBlob) {
+                dropped_blobs_.emplace_back(DecodeFixed64(trans.s_.data() + trans.k_len_));
+                return;
+            }
+            if (!(trans.flags_ & kMerge)) {
+                return;
+            }
+            std::string buf;
+            for (uint64_t prev = DecodeFixed64(trans.s_.data() + trans.k_len_); prev != UINT64_MAX;) {
+                logream::Slice input = ReadRecord(prev, &buf);
+                uint32_t k_len;
+                uint32_t flags;
+                uint64_t expire;
+                GetKVHeader(&input, &k_len, &flags, &expire);
+                if (flags & kBlob) {
+                    dropped_blobs_.emplace_back(DecodeFixed64(input.data() + k_len));
+                    return;
+                }
+                if (!(flags & kMerge)) {
+                    return;
+                }
+                prev = DecodeFixed64(input.data() + k_len);
+            }
+        }
+
+        // 读取 blob 的路径都持有 mutex_, 已打开的 blob 不受删除影响
+        void RemoveDroppedBlobs() {
+            std::string fname;
+            for (size_t seq:dropped_blobs_) {
+                manager_->BlobFilename(seq, &fname);
+                std::remove(fname.c_str());
+            }
+            dropped_blobs_.clear();
+        }
+
+        // 调用方持有 mutex_; 空间不足时在写入前换新 Store, ReserveLocked 预留的额度足够时直接扣除
+        // 写接口入口处已限制记录长度(Store::kMaxRecordSize), 换新后总能预留成功
+        // 新 Store 可能恰好被其他 shard 写满, 此时继续换新
+        void ReserveStore(size_t n) {
+            if (n <= store_budget_) {
+                store_budget_ -= n;
+                return;
+            }
+            assert(n <= Store::kMaxRecordSize + kRecordOverhead);
+            while (!curr_->Reserve(n)) {
+                RolloverStore();
+            }
+        }
+
+        // 调用方持有 mutex_
+        void RolloverStore() {
+            curr_ = manager_->OpenStoreForReadWrite(&seq_, curr_);
+            store_budget_ = 0;
+        }
+
+        std::shared_ptr<Store> OpenStore(size_t seq) const {
+            return seq != seq_ ? manager_->OpenStoreForRandomRead(seq) : curr_;
+        }
+
+        logream::Slice ReadRecord(uint64_t rep, std::string * buf) const {
+            auto[seq, id] = GetKVSeqAndID(rep);
+            buf->clear();
+            if (OpenStore(seq)->Get(id, buf) == 0) {
+                throw std::logic_error(__PRETTY_FUNCTION__);
+            }
+            return *buf;
+        }
+
+        // 记录读入 buf, input 指向 header 之后
+        bool FindRecord(const Slice & k, std::string * buf,
+                        logream::Slice * input, uint32_t * k_len, uint32_t * flags, uint64_t * expire) const {
+            if (filter_ != nullptr && !filter_->MayContain(k)) {
+                return false;
+            }
+            uint64_t rep = UINT64_MAX;
+            if (!tree_.Get(k, reinterpret_cast<std::string *>(reinterpret_cast<char *>(&rep) + 1))) {
+                return false;
+            }
+            *input = ReadRecord(rep, buf);
+            GetKVHeader(input, k_len, flags, expire);
+            return Slice(input->data(), *k_len) == k && !IsExpired(*expire, NowSeconds());
+        }
+
+        // 分离的 value 与 blob 按需单独读入 buf, 返回值总是 buf 的后缀或指向 input 内部
+        logream::Slice LoadValue(logream::Slice input, uint32_t k_len, uint32_t flags,
+                                 std::string * buf) const {
+            if (flags & kMerge) {
+                if (merge_operator_ == nullptr) {
+                    throw std::logic_error("merge operator not provided");
+                }
+                std::string k(input.data(), k_len);
+                const char * p = input.data() + k_len;
+                uint64_t prev = DecodeFixed64(p);
+                std::string operand(p + sizeof(uint64_t) * 2, input.size() - k_len - sizeof(uint64_t) * 2);
+                std::string existing;
+                buf->clear();
+                if (prev != UINT64_MAX && ResolveValue(k, prev, &existing)) {
+                    Slice s = existing;
+                    merge_operator_->Merge(k, &s, operand, buf);
+                } else {
+                    merge_operator_->Merge(k, nullptr, operand, buf);
+                }
+                return *buf;
+            }
+            if (flags & kSeparated) {
+                input = ReadRecord(DecodeFixed64(input.data() + k_len), buf);
+                GetKVHeader(&input, &k_len, &flags);
+                assert(k_len == 0 && flags == kValue);
+                return input;
+            }
+            if (flags & kBlob) {
+                size_t seq = DecodeFixed64(input.data() + k_len);
+                size_t size = DecodeFixed64(input.data() + k_len + sizeof(uint64_t));
+                std::string fname;
+                manager_->BlobFilename(seq, &fname);
+                ReadBlob(fname, size, buf);
+                return *buf;
+            }
+            return {input.data() + k_len, input.size() - k_len};
+        }
+
+        // rep 处的记录展开为完整的 value, 已过期返回 false
+        // merge 链经由 LoadValue 递归展开, 深度不超过 kMaxMergeDepth
+        bool ResolveValue(const Slice & k, uint64_t rep, std::string * value) const {
+            std::string buf;
+            logream::Slice input = ReadRecord(rep, &buf);
+            uint32_t k_len;
+            uint32_t flags;
+            uint64_t expire;
+            GetKVHeader(&input, &k_len, &flags, &expire);
+            if (IsExpired(expire, NowSeconds())) {
+                return false;
+            }
+            auto v = LoadValue(input, k_len, flags, &buf);
+            value->assign(v.data(), v.size());
+            return true;
+        }
+
+        // filter 满时在内存中扩容, 写路径上不会因此读 Store
+        void FilterAdd(const Slice & k) {
+            if (filter_ != nullptr) {
+                filter_->Add(k);
+            }
+        }
+
+        // 没有可用的 filter 文件时, 打开 index 时遍历一次 key 重建, 容量按 stats_ 中的 key 数预留
+        void LoadFilter() {
+            std::ifstream f(filter_fname_, std::ios::binary);
+            if (f) {
+                std::string buf{std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>()};
+                filter_ = std::make_unique<CuckooFilter>(0);
+                if (filter_->DecodeFrom(buf)) {
+                    return;
+                }
+            }
+
+            filter_ = std::make_unique<CuckooFilter>(
+                    std::max<size_t>(stats_.Count() + stats_.Count() / 4, kFilterInitCapacity));
+            auto iter = tree_.GetIterator();
+            for (iter.SeekToFirst(); iter.Valid(); iter.Next()) {
+                filter_->Add(iter.Key());
+            }
+        }
+
+        // 升级前的 DB 没有 stats 文件, 遍历一次重建
+        void LoadStats() {
+            std::ifstream f(stats_fname_, std::ios::binary);
+            if (f) {
+                std::string buf{std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>()};
+                if (stats_.DecodeFrom(buf)) {
+                    return;
+                }
+            }
+
+            // 异常退出后重建: 只读 key 记录, 分离的 value 先以其下限 separate_threshold_ 计
+            // 最终留下的样本再读出实际长度, 不读 blob
+            stats_ = IndexStats();
+            auto iter = tree_.GetIterator();
+            for (iter.SeekToFirst(); iter.Valid(); iter.Next()) {
+                Slice k = iter.Key(); // 记录载入 helper_.backup_
+                logream::Slice input(helper_.backup_);
+                uint32_t k_len;
+                uint32_t flags;
+                uint64_t expire;
+                GetKVHeader(&input, &k_len, &flags, &expire);
+                if (flags & kBlob) {
+                    stats_.OnInsert(k, k_len + DecodeFixed64(input.data() + k_len + sizeof(uint64_t)));
+                } else if (flags & kSeparated) {
+                    stats_.OnInsert(k, k_len + separate_threshold_);
+                } else if (flags & kMerge) { // 以最新的 operand 计
+                    stats_.OnInsert(k, input.size() - sizeof(uint64_t) * 2);
+                } else {
+                    stats_.OnInsert(k, input.size());
+                }
+            }
+
+            std::string buf;
+            for (const std::string & k:stats_.SampleKeys()) {
+                logream::Slice input;
+                uint32_t k_len;
+                uint32_t flags;
+                uint64_t expire;
+                if (FindRecord(k, &buf, &input, &k_len, &flags, &expire) && (flags & kSeparated)) {
+                    logream::Slice value = ReadRecord(DecodeFixed64(input.data() + k_len), &buf);
+                    GetKVHeader(&value, &k_len, &flags);
+                    stats_.OnOverwrite(k, k.size() + value.size());
+                }
+            }
+        }
+
+        void SaveStats() const {
+            std::string buf;
+            stats_.EncodeTo(&buf);
+            std::ofstream f(stats_fname_, std::ios::binary | std::ios::trunc);
+            f.write(buf.data(), buf.size());
+        }
+
+        void SaveFilter() const {
+            std::string buf;
+            filter_->EncodeTo(&buf);
+            std::ofstream f(filter_fname_, std::ios::binary | std::ios::trunc);
+            f.write(buf.data(), buf.size());
+        }
     };
 
     class IteratorImpl : public Iterator {
@@ -303,41 +1134,44 @@ namespace levidb {
 
         void SeekToFirst() override {
             iter_.SeekToFirst();
-            load_ = false;
+            SkipExpired(true);
         }
 
         void SeekToLast() override {
             iter_.SeekToLast();
-            load_ = false;
+            SkipExpired(false);
         }
 
         void Seek(const Slice & target) override {
-            std::lock_guard guard(index_->mutex_);
-            iter_.Seek(target);
-            if (iter_.Valid() && SliceComparator()(iter_.Key(), target)) {
-                do {
-                    iter_.Next();
-                } while (iter_.Valid() && SliceComparator()(iter_.Key(), target));
-            } else if (iter_.Valid() && SliceComparator()(target, iter_.Key())) {
-                int i = 0;
-                for (auto mirror = iter_;
-                     mirror.Valid() && SliceComparator()(target, mirror.Key());
-                     mirror.Prev(), ++i) {
-                }
-                for (--i; i > 0; --i) {
-                    iter_.Prev();
+            {
+                std::lock_guard guard(index_->mutex_);
+                iter_.Seek(target);
+                if (iter_.Valid() && SliceComparator()(iter_.Key(), target)) {
+                    do {
+                        iter_.Next();
+                    } while (iter_.Valid() && SliceComparator()(iter_.Key(), target));
+                } else if (iter_.Valid() && SliceComparator()(target, iter_.Key())) {
+                    int i = 0;
+                    for (auto mirror = iter_;
+                         mirror.Valid() && SliceComparator()(target, mirror.Key());
+                         mirror.Prev(), ++i) {
+                    }
+                    for (--i; i > 0; --i) {
+                        iter_.Prev();
+                    }
                 }
             }
+            SkipExpired(true);
         }
 
         void Next() override {
             iter_.Next();
-            load_ = false;
+            SkipExpired(true);
         }
 
         void Prev() override {
             iter_.Prev();
-            load_ = false;
+            SkipExpired(false);
         }
 
         Slice Key() const override {
@@ -357,6 +1191,31 @@ namespace levidb {
             }
             return iter_.Value();
         }
+
+    private:
+        void SkipExpired(bool forward) {
+            uint64_t now = NowSeconds();
+            while (iter_.Valid()) {
+                {
+                    std::lock_guard guard(index_->mutex_);
+                    iter_.Key(); // 记录载入 helper_.backup_, 从其 header 取过期时间
+                    logream::Slice input(index_->helper_.backup_);
+                    uint32_t k_len;
+                    uint32_t flags;
+                    uint64_t expire;
+                    GetKVHeader(&input, &k_len, &flags, &expire);
+                    if (!IsExpired(expire, now)) {
+                        break;
+                    }
+                }
+                if (forward) {
+                    iter_.Next();
+                } else {
+                    iter_.Prev();
+                }
+            }
+            load_ = false;
+        }
     };
 
     std::unique_ptr<Iterator>
@@ -365,44 +1224,68 @@ namespace levidb {
     }
 
     void KVTrans::LoadKV() {
-        auto[seq, id] = GetKVSeqAndID(rep_);
-        auto store = helper_->index_->seq_ != seq ? helper_->index_->manager_->OpenStoreForRandomRead(seq)
-                                                  : helper_->index_->curr_;
-        helper_->backup_.clear();
-        auto pos = store->Get(id, &helper_->backup_);
-        if (pos == 0) {
-            throw std::logic_error(__PRETTY_FUNCTION__);
-        }
-        s_ = helper_->backup_;
-        logream::GetVarint32(&s_, &k_len_);
+        s_ = helper_->index_->ReadRecord(rep_, &helper_->backup_);
+        GetKVHeader(&s_, &k_len_, &flags_, &expire_);
+    }
+
+    void KVTrans::LoadValue(std::string * v) const {
+        auto value = helper_->index_->LoadValue(s_, k_len_, flags_, v);
+        v->erase(0, v->size() - value.size());
     }
 
     uint64_t Helper::Add(const sgt::Slice & k, const sgt::Slice & v) {
+        if (token_ != UINT64_MAX) {
+            return token_;
+        }
         backup_.clear();
-        logream::PutVarint32(&backup_, static_cast<uint32_t>(k.size()));
-        backup_.append(k.data(), k.size());
-        backup_.append(v.data(), v.size());
+        if (flags_ != 0) {
+            PutKVHeader(&backup_, k.size(), flags_, write_expire_, index_->keyspace_, write_batch_);
+            backup_.append(k.data(), k.size());
+            backup_.append(v.data(), v.size());
+        } else if (v.size() >= index_->separate_threshold_) {
+            PutKVHeader(&backup_, 0, kValue);
+            backup_.append(v.data(), v.size());
+            uint64_t value_rep = Append();
+            backup_.clear();
+            PutKVHeader(&backup_, k.size(), kSeparated, write_expire_, index_->keyspace_, write_batch_);
+            backup_.append(k.data(), k.size());
+            PutFixed64(&backup_, value_rep);
+        } else {
+            PutKVHeader(&backup_, k.size(), 0, write_expire_, index_->keyspace_, write_batch_);
+            backup_.append(k.data(), k.size());
+            backup_.append(v.data(), v.size());
+        }
+        return Append();
+    }
+
+    uint64_t Helper::Append() {
+        index_->ReserveStore(backup_.size());
         auto id = index_->curr_->Add(backup_, false);
         return KVRep(static_cast<uint32_t>(index_->seq_), static_cast<uint32_t>(id));
     }
 
     void Helper::Del(levidb::KVTrans & trans) {
+        if (quiet_) {
+            return;
+        }
+        index_->DropBlob(trans);
         backup_.clear();
-        logream::PutVarint32(&backup_, 0);
+        PutKVHeader(&backup_, 0, 0, 0, index_->keyspace_, write_batch_);
         Slice k = trans.Key();
         backup_.append(k.data(), k.size());
-        index_->curr_->Add(backup_, false);
+        Append();
     }
 
     std::unique_ptr<Index>
-    Index::Open(const std::string & fname, StoreManager * manager) {
-        return std::make_unique<IndexImpl>(penv::Env::Default()->OpenMmapFile(fname), manager);
+    Index::Open(const std::string & fname, StoreManager * manager,
+                const OpenOptions & options, uint32_t keyspace) {
+        return std::make_unique<IndexImpl>(fname, manager, options, keyspace);
     }
 
     std::unique_ptr<Index>
     Index::Reopen(const std::string & fname, StoreManager * manager,
+                  const OpenOptions & options, uint32_t keyspace,
                   size_t alloc, int64_t recycle) {
-        return std::make_unique<IndexImpl>(penv::Env::Default()->ReopenMmapFile(fname), manager,
-                                           alloc, recycle);
+        return std::make_unique<IndexImpl>(fname, manager, options, keyspace, alloc, recycle);
     }
 }
\ No newline at end of file
@@ -9,6 +9,8 @@
 #include <memory>
 
 #include "../include/iterator.h"
+#include "../include/options.h"
+#include "../include/value_stream.h"
 #include "store_manager.h"
 
 namespace levidb {
@@ -23,12 +25,61 @@ namespace levidb {
 
         virtual bool GetInternal(const Slice & k, uint64_t * v) const = 0;
 
-        virtual bool Add(const Slice & k, const Slice & v, bool overwrite) = 0;
+        // expire 为过期时间(unix 秒), 0 表示永不过期
+        virtual bool Add(const Slice & k, const Slice & v, bool overwrite, uint64_t expire) = 0;
 
-        virtual bool AddInternal(const Slice & k, uint64_t v) = 0;
+        // 插入 BulkLoader 写入 Store 的记录, k 在导入开始后被写入或删除过时不插入
+        // size 为 k + v 的长度, 计入统计
+        virtual bool AddInternal(const Slice & k, uint64_t v, uint64_t size, size_t min_seq) = 0;
+
+        virtual bool AddBlob(const Slice & k, size_t seq, size_t size) = 0;
+
+        virtual std::unique_ptr<ValueReader>
+        GetStream(const Slice & k) const = 0;
 
         virtual bool Del(const Slice & k) = 0;
 
+        virtual bool Merge(const Slice & k, const Slice & operand) = 0;
+
+        // 当前 value 等于 expected 时替换为 v
+        virtual bool CompareAndSwap(const Slice & k, const Slice & expected, const Slice & v) = 0;
+
+        // 仅当 k 仍指向 rep 时移除, 不写 tombstone(所在 Store 即将整体删除)
+        virtual bool DelExpired(const Slice & k, uint64_t rep) = 0;
+
+        // 跨 index 的原子写入: 按地址顺序 Lock 涉及的所有 index, 写完后 Unlock
+        virtual void Lock() = 0;
+
+        virtual void Unlock() = 0;
+
+        // 调用方持有 Lock; 为之后 n 次 WriteLocked 预先扩展 index 文件, 并在 Store 中预留 bytes(k + v 的总长)
+        // 失败时抛出, 不修改树
+        virtual void ReserveLocked(size_t n, size_t bytes) = 0;
+
+        // 调用方持有 Lock, v 为 nullptr 表示删除; 记录带上 batch id
+        virtual void WriteLocked(const Slice & k, const Slice * v, uint64_t batch) = 0;
+
+        // 调用方持有 Lock, batch 的全部记录写入后追加提交标记, 空间已由 ReserveLocked 预留
+        virtual void CommitLocked(uint64_t batch, size_t n) = 0;
+
+        // 写入的 key 记录与 del 带有的 keyspace id, 0 表示 DB 自身
+        virtual uint32_t KeyspaceId() const = 0;
+
+        // 正在写入的 Store
+        virtual size_t StoreSeq() const = 0;
+
+        // BulkLoader 存续期间记下被删除的 key
+        virtual void BeginBulkLoad() = 0;
+
+        virtual void EndBulkLoad() = 0;
+
+        // 精确的 key 数量
+        virtual uint64_t Count() const = 0;
+
+        // 由样本估算 [start, limit) 内的 key 数量与 k + v 总长, limit 为空表示不限
+        virtual void Estimate(const Slice & start, const Slice & limit,
+                              uint64_t * count, uint64_t * bytes) const = 0;
+
         virtual std::unique_ptr<Iterator>
         GetIterator() const = 0;
 
@@ -41,10 +92,12 @@ namespace levidb {
 
     public:
         static std::unique_ptr<Index>
-        Open(const std::string & fname, StoreManager * manager);
+        Open(const std::string & fname, StoreManager * manager,
+             const OpenOptions & options, uint32_t keyspace);
 
         static std::unique_ptr<Index>
         Reopen(const std::string & fname, StoreManager * manager,
+               const OpenOptions & options, uint32_t keyspace,
                size_t alloc, int64_t recycle);
     };
 }
@@ -0,0 +1,125 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "index_file.h"
+
+namespace levidb {
+    static void ThrowErrno() {
+        throw std::runtime_error(strerror(errno));
+    }
+
+    IndexFile::IndexFile(int fd, size_t size, size_t reserve)
+            : fd_(fd),
+              base_(nullptr),
+              size_(size),
+              reserve_(0),
+              hints_(0) {
+        Reserve(std::max(reserve, size));
+        Map(0, size_);
+    }
+
+    IndexFile::~IndexFile() {
+        munmap(base_, reserve_);
+        close(fd_);
+    }
+
+    void IndexFile::Hint(Hints hint) {
+        hints_ |= hint;
+        Advise(0, size_);
+    }
+
+    void IndexFile::Grow() {
+        size_t size = size_ + kSegmentSize;
+        if (ftruncate(fd_, static_cast<off_t>(size)) != 0) {
+            ThrowErrno();
+        }
+        if (size <= reserve_) {
+            Map(size_, kSegmentSize);
+            Advise(size_, kSegmentSize);
+        } else { // 预留区耗尽, 整体搬迁到两倍大的新预留区; 新区映射完成前旧映射保持可用
+            char * old_base = base_;
+            size_t old_reserve = reserve_;
+            Reserve(reserve_ * 2);
+            try {
+                Map(0, size);
+            } catch (...) {
+                munmap(base_, reserve_);
+                base_ = old_base;
+                reserve_ = old_reserve;
+                throw;
+            }
+            munmap(old_base, old_reserve);
+            Advise(0, size);
+        }
+        size_ = size;
+    }
+
+    void IndexFile::Reserve(size_t reserve) {
+        void * p = mmap(nullptr, reserve, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (p == MAP_FAILED) {
+            ThrowErrno();
+        }
+        base_ = static_cast<char *>(p);
+        reserve_ = reserve;
+    }
+
+    void IndexFile::Map(size_t offset, size_t n) {
+        void * p = mmap(base_ + offset, n, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+                        fd_, static_cast<off_t>(offset));
+        if (p == MAP_FAILED) {
+            ThrowErrno();
+        }
+    }
+
+    void IndexFile::Advise(size_t offset, size_t n) const {
+        if (hints_ & RANDOM) {
+            madvise(base_ + offset, n, MADV_RANDOM);
+        }
+#if defined(MADV_HUGEPAGE)
+        if (hints_ & HUGEPAGE) {
+            madvise(base_ + offset, n, MADV_HUGEPAGE);
+        }
+#endif
+    }
+
+    static std::unique_ptr<IndexFile>
+    OpenIndexFile(const std::string & fname, size_t reserve, int flags) {
+        int fd = open(fname.c_str(), O_RDWR | flags, 0644);
+        if (fd < 0) {
+            ThrowErrno();
+        }
+        struct stat st{};
+        if (fstat(fd, &st) != 0) {
+            close(fd);
+            ThrowErrno();
+        }
+
+        // 补齐到 segment 边界, 此后每次 Grow 的映射偏移都是页对齐的
+        auto size = static_cast<size_t>(st.st_size);
+        size_t aligned = (size + IndexFile::kSegmentSize - 1) / IndexFile::kSegmentSize * IndexFile::kSegmentSize;
+        if (aligned == 0) {
+            aligned = IndexFile::kSegmentSize;
+        }
+        if (aligned != size && ftruncate(fd, static_cast<off_t>(aligned)) != 0) {
+            close(fd);
+            ThrowErrno();
+        }
+        return std::make_unique<IndexFile>(fd, aligned, reserve);
+    }
+
+    std::unique_ptr<IndexFile>
+    IndexFile::Open(const std::string & fname, size_t reserve) {
+        return OpenIndexFile(fname, reserve, O_CREAT | O_TRUNC);
+    }
+
+    std::unique_ptr<IndexFile>
+    IndexFile::Reopen(const std::string & fname, size_t reserve) {
+        return OpenIndexFile(fname, reserve, 0);
+    }
+}
@@ -0,0 +1,73 @@
+#pragma once
+#ifndef LEVIDB_INDEX_FILE_H
+#define LEVIDB_INDEX_FILE_H
+
+/*
+ * Index 文件映射
+ *
+ * 启动时预留一大段虚拟地址(PROT_NONE, 不占物理内存)
+ * 文件按固定大小的 segment 增长, 新 segment 直接 MAP_FIXED 到预留区的尾部
+ * 已映射的页既不拷贝也不重映射, Base 保持不变
+ * 只有预留区耗尽时才整体搬迁(极少发生)
+ */
+
+#include <memory>
+#include <string>
+
+namespace levidb {
+    class IndexFile {
+    public:
+        enum : size_t {
+            kSegmentSize = 32 * 1024 * 1024
+        };
+
+        enum Hints {
+            RANDOM = 1,
+            HUGEPAGE = 2,
+        };
+
+    private:
+        int fd_;
+        char * base_;
+        size_t size_;
+        size_t reserve_;
+        int hints_;
+
+    public:
+        IndexFile(int fd, size_t size, size_t reserve);
+
+        ~IndexFile();
+
+        IndexFile(const IndexFile &) = delete;
+
+        IndexFile & operator=(const IndexFile &) = delete;
+
+    public:
+        void * Base() { return base_; }
+
+        const void * Base() const { return base_; }
+
+        size_t GetFileSize() const { return size_; }
+
+        void Hint(Hints hint);
+
+        // 增加一个 segment
+        void Grow();
+
+    public:
+        static std::unique_ptr<IndexFile>
+        Open(const std::string & fname, size_t reserve);
+
+        static std::unique_ptr<IndexFile>
+        Reopen(const std::string & fname, size_t reserve);
+
+    private:
+        void Reserve(size_t reserve);
+
+        void Map(size_t offset, size_t n);
+
+        void Advise(size_t offset, size_t n) const;
+    };
+}
+
+#endif //LEVIDB_INDEX_FILE_H
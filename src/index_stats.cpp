@@ -0,0 +1,189 @@
+#include <cassert>
+#include <cstring>
+
+#include "crc32c.h"
+#include "index_stats.h"
+
+namespace levidb {
+    static constexpr uint32_t kStatsMagic = 0x4c565332; // "LVS2"
+
+    IndexStats::IndexStats()
+            : count_(0),
+              deleted_in_(0),
+              deleted_out_(0),
+              rnd_(0x9e3779b97f4a7c15) {}
+
+    // 有未补偿的删除时, 新 key 以 deleted_in_ / (deleted_in_ + deleted_out_) 的概率补入样本
+    // 否则按 reservoir sampling 以 kSampleSize / count_ 的概率替换一个样本
+    void IndexStats::OnInsert(const Slice & k, uint64_t size) {
+        ++count_;
+        uint64_t deleted = deleted_in_ + deleted_out_;
+        if (deleted != 0) {
+            if (Random() % deleted < deleted_in_) {
+                --deleted_in_;
+                Append(k, size);
+            } else {
+                --deleted_out_;
+            }
+            return;
+        }
+        if (samples_.size() < kSampleSize) {
+            Append(k, size);
+            return;
+        }
+        uint64_t i = Random() % count_;
+        if (i < kSampleSize) {
+            Replace(static_cast<size_t>(i), k, size);
+        }
+    }
+
+    void IndexStats::OnOverwrite(const Slice & k, uint64_t size) {
+        auto it = pos_.find(k.ToString());
+        if (it != pos_.end()) {
+            samples_[it->second].second = size;
+        }
+    }
+
+    // 被删除的样本由末尾的样本填补, 空位由之后的插入按概率补回
+    void IndexStats::OnDelete(const Slice & k) {
+        assert(count_ > 0);
+        --count_;
+        auto it = pos_.find(k.ToString());
+        if (it == pos_.end()) {
+            ++deleted_out_;
+            return;
+        }
+        ++deleted_in_;
+        size_t i = it->second;
+        pos_.erase(it);
+        if (i + 1 != samples_.size()) {
+            samples_[i] = std::move(samples_.back());
+            pos_[samples_[i].first] = i;
+        }
+        samples_.pop_back();
+    }
+
+    std::vector<std::string> IndexStats::SampleKeys() const {
+        std::vector<std::string> result;
+        result.reserve(samples_.size());
+        for (const auto & [k, size]:samples_) {
+            result.emplace_back(k);
+        }
+        return result;
+    }
+
+    void IndexStats::Estimate(const Slice & start, const Slice & limit, uint64_t * count, uint64_t * bytes) const {
+        *count = 0;
+        *bytes = 0;
+        if (samples_.empty()) {
+            return;
+        }
+        uint64_t hit = 0;
+        uint64_t hit_bytes = 0;
+        for (const auto & [k, size]:samples_) {
+            if (!SliceComparator()(k, start) && (limit.size() == 0 || SliceComparator()(k, limit))) {
+                ++hit;
+                hit_bytes += size;
+            }
+        }
+        *count = count_ * hit / samples_.size();
+        *bytes = static_cast<uint64_t>(static_cast<double>(count_) * hit_bytes / samples_.size());
+    }
+
+    /*
+     * magic(u32) + crc(u32) + count(u64) + deleted_in(u64) + deleted_out(u64) + n(u64)
+     * + n * [k_len(u64) + size(u64) + k]
+     */
+    void IndexStats::EncodeTo(std::string * dst) const {
+        std::string body;
+        auto put = [&body](uint64_t v) {
+            body.append(reinterpret_cast<const char *>(&v), sizeof(v));
+        };
+        put(count_);
+        put(deleted_in_);
+        put(deleted_out_);
+        put(samples_.size());
+        for (const auto & [k, size]:samples_) {
+            put(k.size());
+            put(size);
+            body.append(k);
+        }
+
+        uint32_t crc = Crc32c(body.data(), body.size());
+        dst->append(reinterpret_cast<const char *>(&kStatsMagic), sizeof(kStatsMagic));
+        dst->append(reinterpret_cast<const char *>(&crc), sizeof(crc));
+        dst->append(body);
+    }
+
+    bool IndexStats::DecodeFrom(const Slice & src) {
+        const char * p = src.data();
+        const char * limit = src.data() + src.size();
+        auto get = [&p, limit](uint64_t * v) -> bool {
+            if (static_cast<size_t>(limit - p) < sizeof(*v)) {
+                return false;
+            }
+            memcpy(v, p, sizeof(*v));
+            p += sizeof(*v);
+            return true;
+        };
+
+        uint32_t magic;
+        uint32_t crc;
+        if (src.size() < sizeof(magic) + sizeof(crc)) {
+            return false;
+        }
+        memcpy(&magic, p, sizeof(magic));
+        p += sizeof(magic);
+        memcpy(&crc, p, sizeof(crc));
+        p += sizeof(crc);
+        if (magic != kStatsMagic || crc != Crc32c(p, static_cast<size_t>(limit - p))) {
+            return false;
+        }
+
+        uint64_t count;
+        uint64_t deleted_in;
+        uint64_t deleted_out;
+        uint64_t n;
+        if (!get(&count) || !get(&deleted_in) || !get(&deleted_out) || !get(&n)) {
+            return false;
+        }
+        std::vector<std::pair<std::string, uint64_t>> samples;
+        for (uint64_t i = 0; i < n; ++i) {
+            uint64_t k_len;
+            uint64_t size;
+            if (!get(&k_len) || !get(&size) || static_cast<uint64_t>(limit - p) < k_len) {
+                return false;
+            }
+            samples.emplace_back(std::string(p, k_len), size);
+            p += k_len;
+        }
+
+        count_ = count;
+        deleted_in_ = deleted_in;
+        deleted_out_ = deleted_out;
+        samples_ = std::move(samples);
+        pos_.clear();
+        for (size_t i = 0; i < samples_.size(); ++i) {
+            pos_.emplace(samples_[i].first, i);
+        }
+        return true;
+    }
+
+    void IndexStats::Append(const Slice & k, uint64_t size) {
+        pos_.emplace(k.ToString(), samples_.size());
+        samples_.emplace_back(k.ToString(), size);
+    }
+
+    void IndexStats::Replace(size_t i, const Slice & k, uint64_t size) {
+        pos_.erase(samples_[i].first);
+        samples_[i] = {k.ToString(), size};
+        pos_.emplace(samples_[i].first, i);
+    }
+
+    uint64_t IndexStats::Random() {
+        rnd_ ^= rnd_ << 13;
+        rnd_ ^= rnd_ >> 7;
+        rnd_ ^= rnd_ << 17;
+        return rnd_;
+    }
+}
@@ -0,0 +1,64 @@
+#pragma once
+#ifndef LEVIDB_INDEX_STATS_H
+#define LEVIDB_INDEX_STATS_H
+
+/*
+ * 单个 index 的统计信息
+ * count 精确, 随 Add/Del 增减
+ * 另以 reservoir sampling 维护定长的 key 样本(连同 k + v 的长度), 用于估算任意范围
+ * 删除以 random pairing 补偿: 之后的插入与删除配对, 样本始终在现有 key 中均匀分布
+ */
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "../include/slice.h"
+
+namespace levidb {
+    class IndexStats {
+    private:
+        enum {
+            kSampleSize = 1024
+        };
+
+        uint64_t count_;
+        uint64_t deleted_in_; // 尚未补偿的删除, 被删除的 key 在样本中
+        uint64_t deleted_out_; // 同上, 不在样本中
+        std::vector<std::pair<std::string, uint64_t>> samples_;
+        std::unordered_map<std::string, size_t> pos_;
+        uint64_t rnd_;
+
+    public:
+        IndexStats();
+
+    public:
+        void OnInsert(const Slice & k, uint64_t size);
+
+        void OnOverwrite(const Slice & k, uint64_t size);
+
+        void OnDelete(const Slice & k);
+
+        uint64_t Count() const { return count_; }
+
+        std::vector<std::string> SampleKeys() const;
+
+        // [start, limit), limit 为空表示不限
+        void Estimate(const Slice & start, const Slice & limit, uint64_t * count, uint64_t * bytes) const;
+
+        void EncodeTo(std::string * dst) const;
+
+        bool DecodeFrom(const Slice & src);
+
+    private:
+        void Append(const Slice & k, uint64_t size);
+
+        void Replace(size_t i, const Slice & k, uint64_t size);
+
+        uint64_t Random();
+    };
+}
+
+#endif //LEVIDB_INDEX_STATS_H
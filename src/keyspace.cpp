@@ -0,0 +1,149 @@
+#include <algorithm>
+#include <cstdio>
+#include <stdexcept>
+
+#include "blob.h"
+#include "bulk_loader.h"
+#include "db_impl.h"
+#include "keyspace.h"
+#include "kv_format.h"
+#include "update_iterator.h"
+
+namespace levidb {
+    KeyspaceImpl::KeyspaceImpl(DBImpl * db, const std::string & dirname,
+                               const OpenOptions & options, bool reopen)
+            : db_(db),
+              dirname_(dirname),
+              options_(options),
+              index_(reopen ? db->ReopenIndexes(dirname, options) : db->OpenIndexes(dirname, options)) {
+        if (options_.shard_affinity) {
+            index_.EnableShardAffinity();
+        }
+    }
+
+    bool KeyspaceImpl::Get(const Slice & k, std::string * v) const {
+        return index_.Get(k, v);
+    }
+
+    std::unique_ptr<Iterator>
+    KeyspaceImpl::GetIterator() const {
+        return index_.GetIterator();
+    }
+
+    void KeyspaceImpl::ParallelScan(size_t num_threads, const ScanCallback & callback,
+                                    const Slice * begin, const Slice * end) const {
+        index_.ParallelScan(num_threads, callback, begin, end);
+    }
+
+    void KeyspaceImpl::PhysicalScan(size_t num_threads, const ScanCallback & callback) const {
+        db_->ScanStores(index_, num_threads, callback);
+    }
+
+    std::unique_ptr<UpdateIterator>
+    KeyspaceImpl::GetUpdatesSince(size_t seq, size_t id) const {
+        return std::make_unique<UpdateIteratorImpl>(db_, seq, id, index_.KeyspaceId());
+    }
+
+    Status KeyspaceImpl::Add(const Slice & k, const Slice & v) {
+        return CheckedWrite(k, v, [&]() { index_.Add(k, v, true, 0); });
+    }
+
+    Status KeyspaceImpl::Add(const Slice & k, const Slice & v, std::chrono::seconds ttl) {
+        return CheckedWrite(k, v, [&]() {
+            index_.Add(k, v, true, NowSeconds() + std::max<int64_t>(ttl.count(), 0));
+        });
+    }
+
+    Status KeyspaceImpl::Del(const Slice & k) {
+        return CheckedWrite(k, {}, [&]() { index_.Del(k); });
+    }
+
+    Status KeyspaceImpl::PutIfAbsent(const Slice & k, const Slice & v, bool * inserted) {
+        *inserted = false;
+        return CheckedWrite(k, v, [&]() { *inserted = index_.Add(k, v, false, 0); });
+    }
+
+    Status KeyspaceImpl::CompareAndSwap(const Slice & k, const Slice & expected, const Slice & v, bool * swapped) {
+        *swapped = false;
+        return CheckedWrite(k, v, [&]() { *swapped = index_.CompareAndSwap(k, expected, v); });
+    }
+
+    Status KeyspaceImpl::Merge(const Slice & k, const Slice & operand) {
+        if (options_.merge_operator == nullptr) {
+            return Status::NotSupported("merge operator not provided");
+        }
+        return CheckedWrite(k, operand, [&]() { index_.Merge(k, operand); });
+    }
+
+    Status KeyspaceImpl::Write(const WriteBatch & batch) {
+        return db_->Write(batch);
+    }
+
+    Status KeyspaceImpl::AddStream(const Slice & k, ValueReader * reader) {
+        return CheckedWrite(k, {}, [&]() {
+            std::string fname;
+            size_t seq = db_->manager_.NewBlob(&fname);
+            try {
+                size_t size = WriteBlob(fname, reader);
+                index_.AddBlob(k, seq, size);
+            } catch (...) { // 未进入索引的 blob 无人引用
+                std::remove(fname.c_str());
+                throw;
+            }
+        });
+    }
+
+    std::unique_ptr<ValueReader>
+    KeyspaceImpl::GetStream(const Slice & k) const {
+        return index_.GetStream(k);
+    }
+
+    std::future<bool>
+    KeyspaceImpl::GetAsync(const Slice & k, std::string * v) const {
+        return index_.GetAsync(k, v);
+    }
+
+    std::future<void> KeyspaceImpl::AddAsync(const Slice & k, const Slice & v) {
+        return index_.AddAsync(k, v, true);
+    }
+
+    std::future<void> KeyspaceImpl::DelAsync(const Slice & k) {
+        return index_.DelAsync(k);
+    }
+
+    uint64_t KeyspaceImpl::Count() const {
+        return index_.Count();
+    }
+
+    void KeyspaceImpl::GetApproximateSizes(const Range * ranges, size_t n, uint64_t * sizes) const {
+        for (size_t i = 0; i < n; ++i) {
+            uint64_t count;
+            index_.Estimate(ranges[i].start, ranges[i].limit, &count, &sizes[i]);
+        }
+    }
+
+    void KeyspaceImpl::GetApproximateCount(const Range * ranges, size_t n, uint64_t * counts) const {
+        for (size_t i = 0; i < n; ++i) {
+            uint64_t bytes;
+            index_.Estimate(ranges[i].start, ranges[i].limit, &counts[i], &bytes);
+        }
+    }
+
+    std::unique_ptr<BulkLoader>
+    KeyspaceImpl::NewBulkLoader(bool sorted) {
+        return std::make_unique<BulkLoaderImpl>(db_, &index_, sorted);
+    }
+
+    DB *
+    KeyspaceImpl::OpenKeyspace(const std::string & name, const OpenOptions & options) {
+        return db_->OpenKeyspace(name, options);
+    }
+
+    bool KeyspaceImpl::Compact() {
+        return db_->Compact();
+    }
+
+    Status KeyspaceImpl::Sync() {
+        return ToStatus([&]() { index_.Sync(); });
+    }
+}
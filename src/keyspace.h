@@ -0,0 +1,87 @@
+#pragma once
+#ifndef LEVIDB_KEYSPACE_H
+#define LEVIDB_KEYSPACE_H
+
+/*
+ * DB 内的具名 keyspace
+ * index 文件位于独立子目录, Store, 文件句柄缓存与 Compact 由 DBImpl 统一管理
+ */
+
+#include "../include/db.h"
+#include "concurrent_index.h"
+
+namespace levidb {
+    class DBImpl;
+
+    class KeyspaceImpl : public DB {
+    private:
+        DBImpl * db_;
+        const std::string dirname_;
+        const OpenOptions options_;
+        ConcurrentIndex index_;
+
+        friend class DBImpl;
+
+    public:
+        KeyspaceImpl(DBImpl * db, const std::string & dirname,
+                     const OpenOptions & options, bool reopen);
+
+    public:
+        bool Get(const Slice & k, std::string * v) const override;
+
+        std::unique_ptr<Iterator>
+        GetIterator() const override;
+
+        void ParallelScan(size_t num_threads, const ScanCallback & callback,
+                          const Slice * begin, const Slice * end) const override;
+
+        void PhysicalScan(size_t num_threads, const ScanCallback & callback) const override;
+
+        std::unique_ptr<UpdateIterator>
+        GetUpdatesSince(size_t seq, size_t id) const override;
+
+        Status Add(const Slice & k, const Slice & v) override;
+
+        Status Add(const Slice & k, const Slice & v, std::chrono::seconds ttl) override;
+
+        Status Del(const Slice & k) override;
+
+        Status PutIfAbsent(const Slice & k, const Slice & v, bool * inserted) override;
+
+        Status CompareAndSwap(const Slice & k, const Slice & expected, const Slice & v, bool * swapped) override;
+
+        Status Merge(const Slice & k, const Slice & operand) override;
+
+        Status Write(const WriteBatch & batch) override;
+
+        Status AddStream(const Slice & k, ValueReader * reader) override;
+
+        std::unique_ptr<ValueReader>
+        GetStream(const Slice & k) const override;
+
+        std::future<bool>
+        GetAsync(const Slice & k, std::string * v) const override;
+
+        std::future<void> AddAsync(const Slice & k, const Slice & v) override;
+
+        std::future<void> DelAsync(const Slice & k) override;
+
+        uint64_t Count() const override;
+
+        void GetApproximateSizes(const Range * ranges, size_t n, uint64_t * sizes) const override;
+
+        void GetApproximateCount(const Range * ranges, size_t n, uint64_t * counts) const override;
+
+        std::unique_ptr<BulkLoader>
+        NewBulkLoader(bool sorted) override;
+
+        DB *
+        OpenKeyspace(const std::string & name, const OpenOptions & options) override;
+
+        bool Compact() override;
+
+        Status Sync() override;
+    };
+}
+
+#endif //LEVIDB_KEYSPACE_H
@@ -0,0 +1,164 @@
+#pragma once
+#ifndef LEVIDB_KV_FORMAT_H
+#define LEVIDB_KV_FORMAT_H
+
+/*
+ * kv = k_len(varint32) + k(char[]) + v(char[])
+ * k_len 的高 8 位为标志, key 长度上限 2^24
+ *
+ * k_len == 0      -> del, 之后是 k
+ * k_len == kValue -> 被分离的 value, 之后是 v
+ * kSeparated      -> k 之后是 value 的 token(fixed64)
+ * kBlob           -> k 之后是 blob 的 seq(fixed64) + 长度(fixed64)
+ * kMerge          -> k 之后是前一条记录的 token(fixed64, 无则 UINT64_MAX) + 链长(fixed64) + operand
+ * kExpire         -> header 与 k 之间是过期时间(fixed64, unix 秒), 可与以上标志并存
+ * kKeyspace       -> 其后是所属 keyspace 的 id(varint32), 不带此标志的属于 DB 自身
+ * kBatch          -> 其后是 WriteBatch 的 id(varint64)
+ * 以上三个可选字段依次位于 header 与 k 之间, 只出现在 key 记录与 del 中, 分离的 value 不带
+ *
+ * k_len == kValue | kBatch -> batch 的提交标记, 之后是 batch id(varint64) + 记录数(varint32)
+ * 全部记录写入后才追加; 没有提交标记的 batch 恢复时整体丢弃
+ */
+
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include "coding.h"
+
+namespace levidb {
+    enum : uint32_t {
+        kKeyLenMask = (static_cast<uint32_t>(1) << 24) - 1,
+        kSeparated = static_cast<uint32_t>(1) << 31,
+        kValue = static_cast<uint32_t>(1) << 30,
+        kBlob = static_cast<uint32_t>(1) << 29,
+        kExpire = static_cast<uint32_t>(1) << 28,
+        kMerge = static_cast<uint32_t>(1) << 27,
+        kKeyspace = static_cast<uint32_t>(1) << 26,
+        kBatch = static_cast<uint32_t>(1) << 25,
+    };
+
+    enum : size_t {
+        kRecordOverhead = 64, // 每次写入的记录头, 分离 value 的 token 与 logream 的分帧(估计值)
+    };
+
+    // 写入任何记录之前检查, 超出上限的 key 会破坏标志位
+    // 抛出的 std::invalid_argument 在写接口的边界处转为 Status::InvalidArgument
+    inline void CheckKeyLength(size_t k_len) {
+        if (k_len > kKeyLenMask) {
+            throw std::invalid_argument("key too long");
+        }
+    }
+
+    inline void PutKVHeader(std::string * dst, size_t k_len, uint32_t flags) {
+        assert(k_len <= kKeyLenMask);
+        logream::PutVarint32(dst, static_cast<uint32_t>(k_len) | flags);
+    }
+
+    inline bool GetKVHeader(logream::Slice * input, uint32_t * k_len, uint32_t * flags) {
+        uint32_t field;
+        if (!logream::GetVarint32(input, &field)) {
+            return false;
+        }
+        *k_len = field & kKeyLenMask;
+        *flags = field & ~kKeyLenMask;
+        return true;
+    }
+
+    inline void PutFixed64(std::string * dst, uint64_t v) {
+        dst->append(reinterpret_cast<const char *>(&v), sizeof(v));
+    }
+
+    inline uint64_t DecodeFixed64(const char * p) {
+        uint64_t v;
+        memcpy(&v, p, sizeof(v));
+        return v;
+    }
+
+    // expire == 0 表示永不过期
+    inline void PutKVHeader(std::string * dst, size_t k_len, uint32_t flags, uint64_t expire) {
+        if (expire == 0) {
+            PutKVHeader(dst, k_len, flags);
+        } else {
+            PutKVHeader(dst, k_len, flags | kExpire);
+            PutFixed64(dst, expire);
+        }
+    }
+
+    // keyspace == 0 表示 DB 自身, batch == 0 表示不属于 WriteBatch
+    inline void PutKVHeader(std::string * dst, size_t k_len, uint32_t flags, uint64_t expire,
+                            uint32_t keyspace, uint64_t batch) {
+        if (keyspace != 0) {
+            flags |= kKeyspace;
+        }
+        if (batch != 0) {
+            flags |= kBatch;
+        }
+        PutKVHeader(dst, k_len, flags, expire);
+        if (keyspace != 0) {
+            logream::PutVarint32(dst, keyspace);
+        }
+        if (batch != 0) {
+            logream::PutVarint64(dst, batch);
+        }
+    }
+
+    // 读出全部可选字段并清除对应标志
+    // 提交标记读作 kValue 与其 batch id, input 余下记录数
+    inline bool GetKVHeader(logream::Slice * input, uint32_t * k_len, uint32_t * flags, uint64_t * expire,
+                            uint32_t * keyspace, uint64_t * batch) {
+        if (!GetKVHeader(input, k_len, flags)) {
+            return false;
+        }
+        *expire = 0;
+        *keyspace = 0;
+        *batch = 0;
+        if (*k_len == 0 && *flags == (kValue | kBatch)) {
+            *flags = kValue;
+            return logream::GetVarint64(input, batch);
+        }
+        if (*flags & kExpire) {
+            if (input->size() < sizeof(uint64_t)) {
+                return false;
+            }
+            *expire = DecodeFixed64(input->data());
+            *input = logream::Slice(input->data() + sizeof(uint64_t), input->size() - sizeof(uint64_t));
+        }
+        if ((*flags & kKeyspace) && !logream::GetVarint32(input, keyspace)) {
+            return false;
+        }
+        if ((*flags & kBatch) && !logream::GetVarint64(input, batch)) {
+            return false;
+        }
+        *flags &= ~(kExpire | kKeyspace | kBatch);
+        return true;
+    }
+
+    // 提交标记与分离的 value 一样读作 kValue, 只关心 key 记录的读取方不必区分
+    inline bool GetKVHeader(logream::Slice * input, uint32_t * k_len, uint32_t * flags, uint64_t * expire) {
+        uint32_t keyspace;
+        uint64_t batch;
+        return GetKVHeader(input, k_len, flags, expire, &keyspace, &batch);
+    }
+
+    inline void PutBatchCommit(std::string * dst, uint64_t batch, uint32_t n) {
+        assert(batch != 0);
+        PutKVHeader(dst, 0, kValue | kBatch);
+        logream::PutVarint64(dst, batch);
+        logream::PutVarint32(dst, n);
+    }
+
+    inline uint64_t NowSeconds() {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::seconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count());
+    }
+
+    inline bool IsExpired(uint64_t expire, uint64_t now) {
+        return expire != 0 && expire <= now;
+    }
+}
+
+#endif //LEVIDB_KV_FORMAT_H
@@ -67,6 +67,14 @@ namespace levidb {
             }
         }
 
+        void Erase(const K & k) {
+            auto it = cache_items_map_.find(k);
+            if (it != cache_items_map_.end()) {
+                cache_items_list_.erase(it->second);
+                cache_items_map_.erase(it);
+            }
+        }
+
         bool Exists(const K & k) const {
             return cache_items_map_.find(k) != cache_items_map_.cend();
         }
@@ -0,0 +1,66 @@
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include <algorithm>
+
+#include "shard_executor.h"
+
+namespace levidb {
+    ShardExecutor::ShardExecutor(size_t n) {
+        size_t cpus = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+        workers_.reserve(n);
+        for (size_t i = 0; i < n; ++i) {
+            workers_.emplace_back(std::make_unique<Worker>());
+            workers_.back()->thread = std::thread(Loop, workers_.back().get(), i % cpus);
+        }
+    }
+
+    ShardExecutor::~ShardExecutor() {
+        for (auto & worker:workers_) {
+            {
+                std::lock_guard guard(worker->mutex);
+                worker->stop = true;
+            }
+            worker->cv.notify_one();
+        }
+        for (auto & worker:workers_) {
+            worker->thread.join();
+        }
+    }
+
+    void ShardExecutor::Submit(size_t nth, std::function<void()> && task) {
+        Worker * worker = workers_[nth].get();
+        {
+            std::lock_guard guard(worker->mutex);
+            worker->tasks.emplace_back(std::move(task));
+        }
+        worker->cv.notify_one();
+    }
+
+    void ShardExecutor::Loop(Worker * worker, size_t cpu) {
+#ifdef __linux__
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set); // 失败时不绑核, 仍可工作
+#endif
+        std::deque<std::function<void()>> batch;
+        while (true) {
+            {
+                std::unique_lock lock(worker->mutex);
+                worker->cv.wait(lock, [worker]() { return worker->stop || !worker->tasks.empty(); });
+                if (worker->tasks.empty()) { // stop
+                    return;
+                }
+                batch.swap(worker->tasks);
+            }
+            // 一次取走整个队列, 执行期间投递者不与 worker 争锁
+            for (auto & task:batch) {
+                task();
+            }
+            batch.clear();
+        }
+    }
+}
@@ -0,0 +1,81 @@
+#pragma once
+#ifndef LEVIDB_SHARD_EXECUTOR_H
+#define LEVIDB_SHARD_EXECUTOR_H
+
+/*
+ * Thread-per-core
+ * 每个 shard 由一个绑定到固定 CPU 的 worker 独占执行
+ * 调用方把操作投递到 shard 的 MPSC 队列, 树的页与 Store 句柄只在该核的 cache 中
+ */
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace levidb {
+    class ShardExecutor {
+    private:
+        struct Worker {
+            std::mutex mutex;
+            std::condition_variable cv;
+            std::deque<std::function<void()>> tasks;
+            bool stop = false;
+            std::thread thread;
+        };
+
+        std::vector<std::unique_ptr<Worker>> workers_;
+
+    public:
+        explicit ShardExecutor(size_t n);
+
+        ~ShardExecutor();
+
+        ShardExecutor(const ShardExecutor &) = delete;
+
+        ShardExecutor & operator=(const ShardExecutor &) = delete;
+
+    public:
+        void Submit(size_t nth, std::function<void()> && task);
+
+        // 阻塞至 worker 执行完 f, 状态都在调用方栈上
+        // 闭包只含一个指针, std::function 不为其分配; 入队时 deque 仍可能分配新的块
+        template<typename F>
+        void Run(size_t nth, F && f) {
+            struct Call {
+                std::remove_reference_t<F> & f;
+                std::exception_ptr error;
+                bool done = false;
+                std::mutex mutex;
+                std::condition_variable cv;
+
+                explicit Call(std::remove_reference_t<F> & fn) : f(fn) {}
+            } call(f);
+            Submit(nth, [c = &call]() {
+                try {
+                    c->f();
+                } catch (...) {
+                    c->error = std::current_exception();
+                }
+                std::lock_guard guard(c->mutex); // 持锁通知, 调用方返回前 cv 不会被析构
+                c->done = true;
+                c->cv.notify_one();
+            });
+            std::unique_lock lock(call.mutex);
+            call.cv.wait(lock, [&call]() { return call.done; });
+            if (call.error) {
+                std::rethrow_exception(call.error);
+            }
+        }
+
+    private:
+        static void Loop(Worker * worker, size_t cpu);
+    };
+}
+
+#endif //LEVIDB_SHARD_EXECUTOR_H
@@ -1,8 +1,23 @@
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <fcntl.h>
+#include <mutex>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <thread>
+#include <type_traits>
+#include <unistd.h>
+
 #include "defs.h"
 #include "env.h"
 #include "logream_compress.h"
 #include "logream_lite.h"
 
+#include "buffer_pool.h"
 #include "filename.h"
 #include "store.h"
 
@@ -36,6 +51,11 @@ namespace levidb {
         ~RandomReaderHelper() override = default;
 
     public:
+        void Hint(Store::AccessPattern pattern) const {
+            file_->Hint(pattern == Store::SEQUENTIAL ? penv::RandomAccessFile::SEQUENTIAL
+                                                     : penv::RandomAccessFile::RANDOM);
+        }
+
         void ReadAt(size_t offset, size_t n, char * scratch) const override {
             file_->ReadAt(offset, n, scratch);
         }
@@ -59,42 +79,164 @@ namespace levidb {
         }
     };
 
-    class CompressedRandomStore : public Store {
+    class DirectReaderHelper : public logream::Reader::Helper {
     private:
-        RandomReaderHelper reader_helper_;
-        logream::ReaderCompress reader_;
+        int fd_;
+        size_t seq_;
+        BufferPool * pool_;
 
     public:
-        explicit CompressedRandomStore(std::unique_ptr<penv::RandomAccessFile> && file)
-                : reader_helper_(std::move(file)),
-                  reader_(&reader_helper_) {}
+        DirectReaderHelper(const std::string & fname, size_t seq, BufferPool * pool)
+                : seq_(seq),
+                  pool_(pool) {
+#if defined(O_DIRECT)
+            fd_ = open(fname.c_str(), O_RDONLY | O_DIRECT);
+            if (fd_ < 0 && errno == EINVAL) { // e.g. tmpfs
+                fd_ = open(fname.c_str(), O_RDONLY);
+            }
+#else
+            fd_ = open(fname.c_str(), O_RDONLY);
+#if defined(F_NOCACHE)
+            if (fd_ >= 0) {
+                fcntl(fd_, F_NOCACHE, 1);
+            }
+#endif
+#endif
+            if (fd_ < 0) {
+                throw std::runtime_error(strerror(errno));
+            }
+        }
 
-        ~CompressedRandomStore() override = default;
+        ~DirectReaderHelper() override {
+            close(fd_);
+        }
 
     public:
-        size_t Get(size_t id, std::string * s) const override {
-            return reader_.Get(id, s);
+        void ReadAt(size_t offset, size_t n, char * scratch) const override {
+            while (n != 0) {
+                size_t block = offset / BufferPool::kBlockSize;
+                size_t in_block = offset % BufferPool::kBlockSize;
+                size_t len = std::min(n, BufferPool::kBlockSize - in_block);
+                if (!pool_->Lookup(seq_, block, in_block, len, scratch)) {
+                    ReadBlock(block, in_block, len, scratch);
+                }
+                offset += len;
+                n -= len;
+                scratch += len;
+            }
+        }
+
+    private:
+        void ReadBlock(size_t block, size_t in_block, size_t len, char * scratch) const {
+            void * p;
+            if (posix_memalign(&p, BufferPool::kAlignment, BufferPool::kBlockSize) != 0) {
+                throw std::bad_alloc();
+            }
+            std::unique_ptr<char, decltype(&free)> buf(static_cast<char *>(p), &free);
+
+            ssize_t r;
+            do {
+                r = pread(fd_, buf.get(), BufferPool::kBlockSize,
+                          static_cast<off_t>(block * BufferPool::kBlockSize));
+            } while (r < 0 && errno == EINTR);
+            if (r < 0) {
+                throw std::runtime_error(strerror(errno));
+            }
+            if (in_block + len > static_cast<size_t>(r)) {
+                throw std::runtime_error(__PRETTY_FUNCTION__);
+            }
+
+            // 尾部不完整的 block 可能仍在追加, 不缓存
+            if (static_cast<size_t>(r) == BufferPool::kBlockSize) {
+                pool_->Insert(seq_, block, buf.get());
+            }
+            memcpy(scratch, buf.get() + in_block, len);
         }
     };
 
-    class PlainRandomStore : public Store {
+    class MmapReaderHelper : public logream::Reader::Helper {
     private:
-        RandomReaderHelper reader_helper_;
-        logream::ReaderLite reader_;
+        const char * base_;
+        size_t size_;
+        std::unique_ptr<penv::RandomAccessFile> file_;
 
     public:
-        explicit PlainRandomStore(std::unique_ptr<penv::RandomAccessFile> && file)
-                : reader_helper_(std::move(file)),
+        // 映射打开时的文件长度, 之后追加的部分(滞后的 shard 仍可能写入)走 pread
+        MmapReaderHelper(const std::string & fname, size_t size)
+                : base_(nullptr),
+                  size_(0),
+                  file_(penv::Env::Default()->OpenRandomAccessFie(fname)) {
+            file_->Hint(penv::RandomAccessFile::RANDOM);
+            int fd = open(fname.c_str(), O_RDONLY);
+            if (fd < 0) {
+                throw std::runtime_error(strerror(errno));
+            }
+            if (size != 0) {
+                void * p = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+                if (p != MAP_FAILED) {
+                    madvise(p, size, MADV_RANDOM);
+                    base_ = static_cast<const char *>(p);
+                    size_ = size;
+                }
+            }
+            close(fd);
+        }
+
+        ~MmapReaderHelper() override {
+            if (base_ != nullptr) {
+                munmap(const_cast<char *>(base_), size_);
+            }
+        }
+
+    public:
+        void Hint(Store::AccessPattern pattern) const {
+            if (base_ != nullptr) {
+                madvise(const_cast<char *>(base_), size_, pattern == Store::SEQUENTIAL ? MADV_SEQUENTIAL : MADV_RANDOM);
+            }
+        }
+
+        void ReadAt(size_t offset, size_t n, char * scratch) const override {
+            if (offset + n <= size_) {
+                memcpy(scratch, base_ + offset, n);
+            } else {
+                file_->ReadAt(offset, n, scratch);
+            }
+        }
+    };
+
+    template<typename HELPER, typename READER>
+    class RandomStore : public Store {
+    private:
+        HELPER reader_helper_;
+        READER reader_;
+
+    public:
+        template<typename... ARGS>
+        explicit RandomStore(ARGS && ... args)
+                : reader_helper_(std::forward<ARGS>(args)...),
                   reader_(&reader_helper_) {}
 
-        ~PlainRandomStore() override = default;
+        ~RandomStore() override = default;
 
     public:
         size_t Get(size_t id, std::string * s) const override {
             return reader_.Get(id, s);
         }
+
+        void Hint(AccessPattern pattern) override {
+            if constexpr (std::is_same_v<HELPER, MmapReaderHelper> || std::is_same_v<HELPER, RandomReaderHelper>) {
+                reader_helper_.Hint(pattern);
+            }
+        }
     };
 
+    using CompressedRandomStore = RandomStore<RandomReaderHelper, logream::ReaderCompress>;
+    using PlainRandomStore = RandomStore<RandomReaderHelper, logream::ReaderLite>;
+    using CompressedDirectStore = RandomStore<DirectReaderHelper, logream::ReaderCompress>;
+    using PlainDirectStore = RandomStore<DirectReaderHelper, logream::ReaderLite>;
+    using CompressedMmapStore = RandomStore<MmapReaderHelper, logream::ReaderCompress>;
+    using PlainMmapStore = RandomStore<MmapReaderHelper, logream::ReaderLite>;
+
     std::unique_ptr<Store>
     Store::OpenForSequentialRead(const std::string & fname) {
         if (IsCompressedStore(fname)) {
@@ -117,28 +259,212 @@ namespace levidb {
         }
     }
 
+    std::unique_ptr<Store>
+    Store::OpenForMmapRead(const std::string & fname, size_t limit) {
+        size_t size = penv::Env::Default()->GetFileSize(fname);
+        if (size > limit) {
+            return OpenForRandomRead(fname);
+        }
+        if (IsCompressedStore(fname)) {
+            return std::make_unique<CompressedMmapStore>(fname, size);
+        } else {
+            return std::make_unique<PlainMmapStore>(fname, size);
+        }
+    }
+
+    std::unique_ptr<Store>
+    Store::OpenForDirectRead(const std::string & fname, size_t seq, BufferPool * pool) {
+        if (IsCompressedStore(fname)) {
+            return std::make_unique<CompressedDirectStore>(fname, seq, pool);
+        } else {
+            return std::make_unique<PlainDirectStore>(fname, seq, pool);
+        }
+    }
+
+    // 预留量包含 logream 的记录头与压缩可能的膨胀, 宁多勿少
+    static size_t ReserveSize(size_t n) {
+        return n + n / 64 + 64;
+    }
+
+    /*
+     * 所有 shard 共享同一个 ReadWriteStore, Helper::Write 不带位置, 记录位置由 WriterLite 按调用顺序分配
+     * 因此 ReadWriteStore::Add 持锁串行调用 WriterLite, 锁内只分帧并把字节暂存于 stage_, 同时占用 tail_ 处的区间
+     * 解锁后各写者并行 pwrite 到各自的区间, tail_ 只在锁内访问, 不再每条记录查询文件长度
+     * 写入前先由 Reserve 在 reserved_ 上预留, 越过 kMaxSize 即封存, 之后的 Reserve 都返回 false
+     * Write 只追加已预留的记录, 不再检查长度
+     * 记录的 token 在 pwrite 返回后才进入索引, 读者不会看到未写完的区间
+     * 顺序读取的变更流可能遇到前面尚未写出的区间, 读到的 0 与不完整的尾部相同, 稍后重试即可
+     *
+     * buffer_size > 0 时追加先进入内存缓冲, 满 buffer_size 或每 flush_interval_ms 刷盘一次
+     * 刷盘前按 kExtentSize 预分配文件空间, 尚未刷盘的记录由 AppendReaderHelper 从缓冲读出
+     */
     class WriterHelper : public logream::Writer::Helper {
     private:
+        enum : size_t {
+            kExtentSize = 64 * 1024 * 1024
+        };
+
         std::unique_ptr<penv::WritableFile> file_;
+        int fd_;
+        size_t tail_;
+        std::atomic<size_t> reserved_;
+        std::string * stage_; // 不为 nullptr 时 Write 只暂存, 由 ReadWriteStore::Add 在锁外写出
+
+        const size_t buffer_size_;
+        mutable std::mutex mutex_;
+        std::string buf_;
+        size_t flushed_; // buf_ 在文件中的起始位置
+        size_t allocated_;
+
+        std::condition_variable cv_;
+        bool stop_;
+        std::thread flusher_;
 
         friend class ReadWriteStore;
 
+        friend class AppendReaderHelper;
+
     public:
-        explicit WriterHelper(std::unique_ptr<penv::WritableFile> && file)
-                : file_(std::move(file)) {}
+        WriterHelper(std::unique_ptr<penv::WritableFile> && file, const std::string & fname,
+                     size_t buffer_size, size_t flush_interval_ms)
+                : file_(std::move(file)),
+                  fd_(open(fname.c_str(), O_WRONLY | O_CLOEXEC)),
+                  tail_(file_->GetFileSize()),
+                  reserved_(tail_),
+                  stage_(nullptr),
+                  buffer_size_(buffer_size),
+                  flushed_(tail_),
+                  allocated_(flushed_),
+                  stop_(false) {
+            if (fd_ < 0) {
+                throw std::runtime_error(strerror(errno));
+            }
+            if (buffer_size_ != 0 && flush_interval_ms != 0) {
+                flusher_ = std::thread([this](std::chrono::milliseconds interval) {
+                    std::unique_lock lock(mutex_);
+                    while (!cv_.wait_for(lock, interval, [this]() { return stop_; })) {
+                        FlushLocked();
+                    }
+                }, std::chrono::milliseconds(flush_interval_ms));
+            }
+        }
 
         ~WriterHelper() override {
+            if (flusher_.joinable()) {
+                {
+                    std::lock_guard guard(mutex_);
+                    stop_ = true;
+                }
+                cv_.notify_one();
+                flusher_.join();
+            }
+            Flush();
             file_->Sync();
+            close(fd_);
         }
 
     public:
+        bool Reserve(size_t n) {
+            n = ReserveSize(n);
+            if (reserved_.fetch_add(n, std::memory_order_relaxed) + n < Store::kMaxSize) {
+                return true;
+            }
+            Flush(); // 封存后以新的 reader 打开, 缓冲必须落盘
+            return false;
+        }
+
         void Write(const logream::Slice & s) override {
-            size_t file_size = file_->GetFileSize();
-            if (file_size + s.size() >= Store::kMaxSize) {
-                throw StoreFullException();
+            if (buffer_size_ != 0) {
+                std::lock_guard guard(mutex_);
+                buf_.append(s.data(), s.size());
+                if (buf_.size() >= buffer_size_) {
+                    FlushLocked();
+                }
+                return;
+            }
+
+            if (stage_ != nullptr) {
+                stage_->append(s.data(), s.size());
+                tail_ += s.size();
+                return;
+            }
+            PositionalWrite(s.data(), s.size(), tail_);
+            tail_ += s.size();
+        }
+
+        void Flush() {
+            if (buffer_size_ != 0) {
+                std::lock_guard guard(mutex_);
+                FlushLocked();
+            }
+        }
+
+    private:
+        void FlushLocked() {
+            if (buf_.empty()) {
+                return;
+            }
+            size_t end = flushed_ + buf_.size();
+            if (end > allocated_) {
+                size_t extent = (end - allocated_ + kExtentSize - 1) / kExtentSize * kExtentSize;
+#if defined(__linux__)
+                fallocate(fd_, FALLOC_FL_KEEP_SIZE, allocated_, extent); // 失败无妨, 只是退化为逐次扩展
+#endif
+                allocated_ += extent;
+            }
+            PositionalWrite(buf_.data(), buf_.size(), flushed_);
+            flushed_ = end;
+            buf_.clear();
+        }
+
+        void PositionalWrite(const char * data, size_t size, size_t offset) const {
+            for (size_t n = 0; n < size;) {
+                ssize_t r = pwrite(fd_, data + n, size - n, offset + n);
+                if (r < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    throw std::runtime_error(strerror(errno));
+                }
+                n += r;
+            }
+        }
+    };
+
+    class AppendReaderHelper : public logream::Reader::Helper {
+    private:
+        std::unique_ptr<penv::RandomAccessFile> file_;
+        const WriterHelper * writer_;
+
+    public:
+        AppendReaderHelper(std::unique_ptr<penv::RandomAccessFile> && file, const WriterHelper * writer)
+                : file_(std::move(file)),
+                  writer_(writer) {
+            file_->Hint(penv::RandomAccessFile::RANDOM);
+        }
+
+        ~AppendReaderHelper() override = default;
+
+    public:
+        // 越过已写入数据的部分填 0, 与读到文件末尾时相同, 由 reader 判定为不完整的记录
+        void ReadAt(size_t offset, size_t n, char * scratch) const override {
+            if (writer_->buffer_size_ != 0) {
+                std::lock_guard guard(writer_->mutex_);
+                size_t flushed = writer_->flushed_;
+                if (offset + n > flushed) {
+                    size_t from = std::max(offset, flushed);
+                    size_t to = std::max(std::min(offset + n, flushed + writer_->buf_.size()), from);
+                    if (to > from) {
+                        memcpy(scratch + (from - offset), writer_->buf_.data() + (from - flushed), to - from);
+                    }
+                    memset(scratch + (to - offset), 0, offset + n - to);
+                    n = from - offset;
+                }
+            }
+            // 已刷盘的部分不会再变化, 无需持锁
+            if (n != 0) {
+                file_->ReadAt(offset, n, scratch);
             }
-            file_->PrepareWrite(file_size, s.size());
-            file_->Write(s);
         }
     };
 
@@ -150,10 +476,12 @@ namespace levidb {
 
         std::unique_ptr<penv::WritableFile> file_;
         std::string buf_;
+        size_t reserved_;
 
     public:
         explicit BufferedWriterHelper(std::unique_ptr<penv::WritableFile> && file)
-                : file_(std::move(file)) {}
+                : file_(std::move(file)),
+                  reserved_(file_->GetFileSize()) {}
 
         ~BufferedWriterHelper() override {
             if (!buf_.empty()) {
@@ -163,13 +491,18 @@ namespace levidb {
         };
 
     public:
-        void Write(const logream::Slice & s) override {
-            size_t file_size = file_->GetFileSize();
-            if (file_size + buf_.size() + s.size() >= Store::kMaxSize) {
-                throw StoreFullException();
+        bool Reserve(size_t n) {
+            n = ReserveSize(n);
+            if (reserved_ + n >= Store::kMaxSize) {
+                return false;
             }
+            reserved_ += n;
+            return true;
+        }
+
+        void Write(const logream::Slice & s) override {
             if (buf_.size() >= kBufLimit) {
-                file_->PrepareWrite(file_size, buf_.size());
+                file_->PrepareWrite(file_->GetFileSize(), buf_.size());
                 file_->Write(buf_);
                 buf_.clear();
             }
@@ -179,26 +512,34 @@ namespace levidb {
 
     class ReadWriteStore : public Store {
     private:
-        RandomReaderHelper reader_helper_;
+        AppendReaderHelper reader_helper_;
         logream::ReaderLite reader_;
         WriterHelper writer_helper_;
         logream::WriterLite writer_;
+        std::mutex mutex_; // 串行调用 writer_
 
     public:
         ReadWriteStore(std::unique_ptr<penv::RandomAccessFile> && r_file,
-                       std::unique_ptr<penv::WritableFile> && w_file)
-                : reader_helper_(std::move(r_file)),
+                       std::unique_ptr<penv::WritableFile> && w_file,
+                       const std::string & fname,
+                       size_t buffer_size, size_t flush_interval_ms)
+                : reader_helper_(std::move(r_file), &writer_helper_),
                   reader_(&reader_helper_),
-                  writer_helper_(std::move(w_file)),
+                  writer_helper_(std::move(w_file), fname, buffer_size, flush_interval_ms),
                   writer_(&writer_helper_, 0) {}
 
         ~ReadWriteStore() override = default;
 
     public:
+        bool Reserve(size_t n) override {
+            return writer_helper_.Reserve(n);
+        }
+
         size_t Add(const Slice & s, bool sync) override {
-            size_t n = s.size();
-            size_t pos = writer_.Add(s.data(), &n);
+            size_t pos;
+            size_t n = Append(&s, 1, &pos);
             if (sync) {
+                writer_helper_.Flush();
 #if defined(PENV_OS_LINUX)
                 writer_helper_.file_->RangeSync(pos, n);
 #else
@@ -208,13 +549,43 @@ namespace levidb {
             return pos;
         }
 
+        void AddBatch(const Slice * records, size_t n, size_t * ids) override {
+            Append(records, n, ids);
+        }
+
         size_t Get(size_t id, std::string * s) const override {
             return reader_.Get(id, s);
         }
 
         void Sync() override {
+            writer_helper_.Flush();
             writer_helper_.file_->Sync();
         }
+
+    private:
+        // 开启写缓冲时记录直接进入缓冲, 无需暂存; 返回最后一条记录分帧后的长度
+        size_t Append(const Slice * records, size_t n, size_t * ids) {
+            thread_local std::string stage;
+            size_t len = 0;
+            size_t offset;
+            {
+                std::lock_guard guard(mutex_);
+                if (writer_helper_.buffer_size_ == 0) {
+                    stage.clear();
+                    writer_helper_.stage_ = &stage;
+                }
+                offset = writer_helper_.tail_;
+                for (size_t i = 0; i < n; ++i) {
+                    len = records[i].size();
+                    ids[i] = writer_.Add(records[i].data(), &len);
+                }
+                writer_helper_.stage_ = nullptr;
+            }
+            if (writer_helper_.buffer_size_ == 0) {
+                writer_helper_.PositionalWrite(stage.data(), stage.size(), offset);
+            }
+            return len;
+        }
     };
 
     class CompressedWriteStore : public Store {
@@ -230,6 +601,10 @@ namespace levidb {
         ~CompressedWriteStore() override = default;
 
     public:
+        bool Reserve(size_t n) override {
+            return writer_helper_.Reserve(n);
+        }
+
         size_t Add(const Slice & s, bool sync) override {
             size_t n = s.size();
             return writer_.Add(s.data(), &n);
@@ -237,10 +612,11 @@ namespace levidb {
     };
 
     std::unique_ptr<Store>
-    Store::OpenForReadWrite(const std::string & fname) {
+    Store::OpenForReadWrite(const std::string & fname, size_t buffer_size, size_t flush_interval_ms) {
         auto w_file = penv::Env::Default()->OpenWritableFile(fname);
         auto r_file = penv::Env::Default()->OpenRandomAccessFie(fname);
-        return std::make_unique<ReadWriteStore>(std::move(r_file), std::move(w_file));
+        return std::make_unique<ReadWriteStore>(std::move(r_file), std::move(w_file), fname,
+                                                buffer_size, flush_interval_ms);
     }
 
     std::unique_ptr<Store>
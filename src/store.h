@@ -6,18 +6,13 @@
  * logream 封装
  */
 
-#include <exception>
+#include <cassert>
 #include <memory>
 
 #include "../include/slice.h"
 
 namespace levidb {
-    class StoreFullException : public std::exception {
-    public:
-        const char * what() const noexcept override {
-            return "no enough space for storage";
-        }
-    };
+    class BufferPool;
 
     class Store {
     public:
@@ -27,14 +22,37 @@ namespace levidb {
 
     public:
         enum : size_t {
-            kMaxSize = static_cast<size_t>(2) * 1024 * 1024 * 1024
+            kMaxSize = static_cast<size_t>(2) * 1024 * 1024 * 1024,
+            kMaxRecordSize = kMaxSize / 4, // 不超过此长度的记录总能放入一个新的 Store
+        };
+
+        enum AccessPattern {
+            RANDOM,
+            SEQUENTIAL,
         };
 
+        // 只对 mmap 与 pread 读取生效, 调整内核的预读
+        virtual void Hint(AccessPattern pattern) {}
+
+        // 为一条长度为 n 的记录预留空间, 返回 false 表示 Store 已封存, 调用方应换新
+        // 预留量是写入长度的上限, 预留成功后的 Add 不会越过 kMaxSize
+        virtual bool Reserve(size_t n) {
+            assert(false);
+            return false;
+        }
+
         virtual size_t Add(const Slice & s, bool sync) {
             assert(false);
             return 0;
         }
 
+        // 依次追加 n 条记录, 位置写入 ids; 共享的 ReadWriteStore 只加一次锁, 只写一次文件
+        virtual void AddBatch(const Slice * records, size_t n, size_t * ids) {
+            for (size_t i = 0; i < n; ++i) {
+                ids[i] = Add(records[i], false);
+            }
+        }
+
         virtual size_t Get(size_t id, std::string * s) const {
             assert(false);
             return 0;
@@ -51,8 +69,17 @@ namespace levidb {
         static std::unique_ptr<Store>
         OpenForRandomRead(const std::string & fname);
 
+        // 长度不超过 limit 的文件以 mmap 读取, 省去每条记录一次 pread
+        static std::unique_ptr<Store>
+        OpenForMmapRead(const std::string & fname, size_t limit);
+
+        // 绕过 page cache, 经由 pool 缓存
+        static std::unique_ptr<Store>
+        OpenForDirectRead(const std::string & fname, size_t seq, BufferPool * pool);
+
+        // buffer_size 为 0 时每条记录直接写入文件
         static std::unique_ptr<Store>
-        OpenForReadWrite(const std::string & fname);
+        OpenForReadWrite(const std::string & fname, size_t buffer_size, size_t flush_interval_ms);
 
         static std::unique_ptr<Store>
         OpenForCompressedWrite(const std::string & fname);
@@ -1,16 +1,81 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <unistd.h>
+
 #include "db_impl.h"
 #include "filename.h"
 #include "store_manager.h"
 
 namespace levidb {
+    static void ThrowErrno() {
+        throw std::runtime_error(strerror(errno));
+    }
+
+    static void CopyFile(const std::string & from, const std::string & to) {
+        int in = open(from.c_str(), O_RDONLY | O_CLOEXEC);
+        if (in < 0) {
+            ThrowErrno();
+        }
+        int out = open(to.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (out < 0) {
+            close(in);
+            ThrowErrno();
+        }
+        char buf[256 * 1024];
+        bool success = true;
+        for (ssize_t r; success && (r = read(in, buf, sizeof(buf))) != 0;) {
+            if (r < 0) {
+                success = errno == EINTR;
+                continue;
+            }
+            for (ssize_t n = 0, w; success && n < r; n += w) {
+                w = write(out, buf + n, static_cast<size_t>(r - n));
+                if (w < 0) {
+                    success = errno == EINTR;
+                    w = 0;
+                }
+            }
+        }
+        success = success && fdatasync(out) == 0;
+        int err = errno;
+        close(in);
+        close(out);
+        if (!success) {
+            std::remove(to.c_str());
+            errno = err;
+            ThrowErrno();
+        }
+    }
+
+    StoreManager::StoreManager(DBImpl * db)
+            : db_(db),
+              seq_(0) {
+        if (db->options_.direct_io) {
+            pool_ = std::make_unique<BufferPool>(db->options_.buffer_pool_size);
+        }
+    }
+
     std::shared_ptr<Store>
     StoreManager::OpenStoreForRandomRead(size_t seq) {
         std::lock_guard guard(mutex_);
         std::shared_ptr<Store> result;
         if (cache_.Get(seq, &result)) {
         } else {
-            StoreFilename(seq, db_->GetLv(seq), db_->IsCompressed(seq), db_->GetName(), &backup_);
-            result = Store::OpenForRandomRead(backup_);
+            size_t lv = db_->GetLv(seq);
+            StoreFilename(seq, lv, db_->IsCompressed(seq), db_->LevelDirname(lv), &backup_);
+            if (seq == seq_) {
+                result = Store::OpenForRandomRead(backup_);
+            } else if (pool_ != nullptr) {
+                result = Store::OpenForDirectRead(backup_, seq, pool_.get());
+            } else if (db_->options_.mmap_store_limit != 0) {
+                result = Store::OpenForMmapRead(backup_, db_->options_.mmap_store_limit);
+            } else {
+                result = Store::OpenForRandomRead(backup_);
+            }
             cache_.Add(seq, result);
         }
         return result;
@@ -21,11 +86,111 @@ namespace levidb {
         std::lock_guard guard(mutex_);
         if (curr_ == nullptr || prev == curr_) {
             seq_ = db_->UniqueSeq();
-            StoreFilename(seq_, 0, false, db_->GetName(), &backup_);
-            curr_ = Store::OpenForReadWrite(backup_);
+            StoreFilename(seq_, 0, false, db_->LevelDirname(0), &backup_);
+            curr_ = Store::OpenForReadWrite(backup_, db_->options_.write_buffer_size,
+                                            db_->options_.write_flush_interval_ms);
             db_->Register(seq_);
         }
         *seq = seq_;
         return curr_;
     }
+
+    size_t StoreManager::NewBlob(std::string * fname) {
+        size_t seq = db_->UniqueSeq();
+        BlobFilename(seq, fname);
+        return seq;
+    }
+
+    void StoreManager::BlobFilename(size_t seq, std::string * fname) const {
+        levidb::BlobFilename(seq, db_->GetName(), fname);
+    }
+
+    void StoreManager::RegisterStore(size_t seq, bool compress) {
+        std::lock_guard guard(mutex_);
+        db_->Register(seq, compress);
+    }
+
+    std::vector<size_t> StoreManager::Stores() const {
+        std::lock_guard guard(mutex_);
+        std::vector<size_t> result;
+        for (const auto & l:db_->stores_) {
+            result.insert(result.end(), l.cbegin(), l.cend());
+        }
+        return result;
+    }
+
+    bool StoreManager::GetStoreFilename(size_t seq, std::string * fname, size_t * lv) const {
+        std::lock_guard guard(mutex_);
+        for (size_t i = 0; i < db_->stores_.size(); ++i) {
+            const auto & l = db_->stores_[i];
+            if (std::find(l.cbegin(), l.cend(), seq) != l.cend()) {
+                StoreFilename(seq, i, db_->IsCompressed(seq), db_->LevelDirname(i), fname);
+                if (lv != nullptr) {
+                    *lv = i;
+                }
+                return true;
+            }
+        }
+        return false;
+    }
+
+    std::vector<size_t> StoreManager::StoresBefore(size_t seq) {
+        std::lock_guard guard(mutex_);
+        std::vector<size_t> result;
+        for (const auto & l:db_->stores_) {
+            for (size_t s:l) {
+                if (s < seq && s != seq_) {
+                    result.emplace_back(s);
+                }
+            }
+        }
+        return result;
+    }
+
+    void StoreManager::RemoveStore(size_t seq) {
+        std::lock_guard guard(mutex_);
+        cache_.Erase(seq);
+        size_t lv = db_->GetLv(seq);
+        StoreFilename(seq, lv, db_->IsCompressed(seq), db_->LevelDirname(lv), &backup_);
+        db_->Unregister(seq);
+        std::remove(backup_.c_str());
+    }
+
+    // 同一文件系统内直接 rename; 跨设备时先复制为临时文件, 不持锁, 完成后再切换
+    void StoreManager::MoveStore(size_t seq, size_t lv) {
+        std::string from;
+        std::string to;
+        {
+            std::lock_guard guard(mutex_);
+            size_t curr = db_->GetLv(seq);
+            bool compress = db_->IsCompressed(seq);
+            StoreFilename(seq, curr, compress, db_->LevelDirname(curr), &from);
+            StoreFilename(seq, lv, compress, db_->LevelDirname(lv), &to);
+            if (rename(from.c_str(), to.c_str()) == 0) {
+                cache_.Erase(seq);
+                db_->Relevel(seq, lv);
+                return;
+            }
+            if (errno != EXDEV) {
+                ThrowErrno();
+            }
+        }
+
+        // 临时文件不以 store_ 开头, 中途崩溃不会被当作 Store 载入, 重新打开时删除
+        std::string temp;
+        TempStoreFilename(to, db_->LevelDirname(lv), &temp);
+        CopyFile(from, temp);
+        {
+            std::lock_guard guard(mutex_);
+            if (rename(temp.c_str(), to.c_str()) != 0) {
+                int err = errno;
+                std::remove(temp.c_str());
+                errno = err;
+                ThrowErrno();
+            }
+            cache_.Erase(seq); // 已打开的 Store 持有旧文件的 fd, 读取不受影响
+            db_->Relevel(seq, lv);
+        }
+        std::remove(from.c_str());
+    }
 }
\ No newline at end of file
@@ -8,7 +8,9 @@
  */
 
 #include <mutex>
+#include <vector>
 
+#include "buffer_pool.h"
 #include "lru_cache.h"
 #include "store.h"
 
@@ -25,17 +27,16 @@ namespace levidb {
         LRUCache<size_t, std::shared_ptr<Store>, kMaxEntries> cache_;
         size_t seq_;
         std::shared_ptr<Store> curr_;
+        std::unique_ptr<BufferPool> pool_;
         std::string backup_;
-        std::mutex mutex_;
+        mutable std::mutex mutex_;
 
     public:
         StoreManager()
                 : db_(nullptr),
                   seq_(0) {};
 
-        explicit StoreManager(DBImpl * db)
-                : db_(db),
-                  seq_(0) {}
+        explicit StoreManager(DBImpl * db);
 
         StoreManager(const StoreManager &) = delete;
 
@@ -47,6 +48,28 @@ namespace levidb {
 
         std::shared_ptr<Store>
         OpenStoreForReadWrite(size_t * seq, std::shared_ptr<Store> prev);
+
+        // Blob 与 Store 共用 seq
+        size_t NewBlob(std::string * fname);
+
+        void BlobFilename(size_t seq, std::string * fname) const;
+
+        // 由外部写好的 Store 加入 DB
+        void RegisterStore(size_t seq, bool compress);
+
+        std::vector<size_t> Stores() const;
+
+        // Store 已被删除时返回 false, lv 不为 nullptr 时一并返回所在层
+        bool GetStoreFilename(size_t seq, std::string * fname, size_t * lv = nullptr) const;
+
+        // 早于 seq 的 Store 不会再被写入
+        std::vector<size_t> StoresBefore(size_t seq);
+
+        // 关闭并删除 Store 文件
+        void RemoveStore(size_t seq);
+
+        // 移至 lv 层的目录, seq 与文件内容不变, 已有的 token 仍然有效
+        void MoveStore(size_t seq, size_t lv);
     };
 }
 
@@ -0,0 +1,193 @@
+#include <algorithm>
+#include <sys/stat.h>
+#include <vector>
+
+#include "blob.h"
+#include "db_impl.h"
+#include "index_format.h"
+#include "kv_format.h"
+#include "update_iterator.h"
+
+namespace levidb {
+    UpdateIteratorImpl::UpdateIteratorImpl(DBImpl * db, size_t seq, size_t id, uint32_t keyspace)
+            : db_(db),
+              start_seq_(seq),
+              keyspace_(keyspace),
+              store_seq_(0),
+              limit_(0),
+              valid_(false),
+              type_(kPut),
+              seq_(0),
+              id_(0),
+              expire_(0) {
+        offsets_[seq] = id;
+        Next();
+    }
+
+    // 按 seq 顺序读完一个 Store 才进入下一个, 已被删除的 Store 跳过
+    // 仍在写入的 Store 读到末尾或空洞时停下, 之后的 Next() 从同一位置继续, 不会越过尚未写完的记录
+    void UpdateIteratorImpl::Next() {
+        valid_ = false;
+        if (store_ != nullptr) {
+            if (ReadRecord()) {
+                return;
+            }
+            if (offsets_[store_seq_] != kDone) {
+                return;
+            }
+        }
+        std::vector<size_t> seqs = db_->manager_.Stores();
+        std::sort(seqs.begin(), seqs.end());
+        for (size_t seq:seqs) {
+            auto it = offsets_.find(seq);
+            if (seq < start_seq_ || (it != offsets_.cend() && it->second == kDone)) {
+                continue;
+            }
+            if (!OpenStore(seq)) {
+                continue;
+            }
+            if (ReadRecord() || offsets_[seq] != kDone) {
+                return;
+            }
+        }
+    }
+
+    // 从头读取的封存 Store 用顺序读, 之后位置与读取顺序一致
+    // 仍在写入或从中途开始的 Store 需要按位置重读, 用随机读并提示内核预读
+    bool UpdateIteratorImpl::OpenStore(size_t seq) {
+        store_.reset();
+        size_t & offset = offsets_.emplace(seq, 0).first->second;
+        bool sealed = seq < db_->MinWritingSeq();
+        std::string fname;
+        {
+            std::lock_guard guard(db_->compact_mutex_); // 期间 Store 不会被移动或删除
+            if (!db_->manager_.GetStoreFilename(seq, &fname)) {
+                offset = kDone;
+                return false;
+            }
+            if (sealed && offset == 0) {
+                store_ = Store::OpenForSequentialRead(fname);
+            } else {
+                store_ = Store::OpenForRandomRead(fname);
+                store_->Hint(Store::SEQUENTIAL);
+            }
+        }
+        store_seq_ = seq;
+        limit_ = 0;
+        return true;
+    }
+
+    // 文件移至其他层的瞬间可能取不到长度, 留待下次
+    bool UpdateIteratorImpl::RefreshLimit() {
+        std::string fname;
+        struct stat st{};
+        if (!db_->manager_.GetStoreFilename(store_seq_, &fname) || stat(fname.c_str(), &st) != 0) {
+            return false;
+        }
+        limit_ = static_cast<size_t>(st.st_size);
+        return true;
+    }
+
+    // 封存时缓冲已刷出, 所有 index 都换用更新的 Store 之后文件长度不再变化
+    // 因此先判断是否封存, 再取长度, 读到末尾即可标记为读完
+    bool UpdateIteratorImpl::ReadRecord() {
+        size_t & offset = offsets_[store_seq_];
+        while (offset != kDone) {
+            if (offset >= limit_) {
+                bool sealed = store_seq_ < db_->MinWritingSeq();
+                if (!RefreshLimit()) {
+                    return false;
+                }
+                if (offset >= limit_) {
+                    if (sealed) {
+                        offset = kDone;
+                    }
+                    return false;
+                }
+            }
+
+            buf_.clear();
+            size_t next = store_->Get(offset, &buf_);
+            if (next == 0) { // 尾部未写完的记录, 封存的 Store 中即为崩溃时的残留
+                if (store_seq_ < db_->MinWritingSeq()) {
+                    offset = kDone;
+                }
+                return false;
+            }
+            size_t id = offset;
+            offset = next;
+
+            logream::Slice input(buf_);
+            uint32_t k_len;
+            uint32_t flags;
+            uint32_t keyspace;
+            uint64_t batch;
+            if (!GetKVHeader(&input, &k_len, &flags, &expire_, &keyspace, &batch)) {
+                continue;
+            }
+            if (k_len == 0 && flags == kValue) { // 分离的 value 随其后的 key 记录一同返回, batch 的提交标记不返回
+                continue;
+            }
+            if (keyspace != keyspace_) {
+                continue;
+            }
+            if (Decode(id, k_len, flags, input.data(), input.size())) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // value 已随之后的覆盖或过期被删除时返回 false, 之后的记录反映了这一变化
+    bool UpdateIteratorImpl::Decode(size_t id, uint32_t k_len, uint32_t flags, const char * p, size_t n) {
+        seq_ = store_seq_;
+        id_ = id;
+        if (k_len == 0) {
+            type_ = kDel;
+            k_ = {p, n};
+            v_ = {};
+            valid_ = true;
+            return true;
+        }
+
+        k_ = {p, k_len};
+        p += k_len;
+        n -= k_len;
+        if (flags & kMerge) {
+            type_ = kMerge;
+            v_ = {p + sizeof(uint64_t) * 2, n - sizeof(uint64_t) * 2};
+            valid_ = true;
+            return true;
+        }
+
+        type_ = kPut;
+        if (flags & kSeparated) {
+            auto[seq, value_id] = GetKVSeqAndID(DecodeFixed64(p));
+            value_.clear();
+            {
+                std::lock_guard guard(db_->compact_mutex_);
+                std::string fname;
+                if (!db_->manager_.GetStoreFilename(seq, &fname)) {
+                    return false;
+                }
+                db_->manager_.OpenStoreForRandomRead(seq)->Get(value_id, &value_);
+            }
+            logream::Slice input(value_);
+            GetKVHeader(&input, &k_len, &flags);
+            v_ = {input.data(), input.size()};
+        } else if (flags & kBlob) {
+            std::string fname;
+            db_->manager_.BlobFilename(DecodeFixed64(p), &fname);
+            try {
+                ReadBlob(fname, DecodeFixed64(p + sizeof(uint64_t)), &value_);
+            } catch (const std::exception &) { // blob 在 key 被覆盖或删除时一同删除
+                return false;
+            }
+            v_ = value_;
+        } else {
+            v_ = {p, n};
+        }
+        valid_ = true;
+        return true;
+    }
+}
\ No newline at end of file
@@ -0,0 +1,77 @@
+#pragma once
+#ifndef LEVIDB_UPDATE_ITERATOR_IMPL_H
+#define LEVIDB_UPDATE_ITERATOR_IMPL_H
+
+#include <map>
+#include <memory>
+#include <string>
+
+#include "../include/update_iterator.h"
+#include "store.h"
+
+namespace levidb {
+    class DBImpl;
+
+    class UpdateIteratorImpl : public UpdateIterator {
+    private:
+        enum : size_t {
+            kDone = SIZE_MAX
+        };
+
+        DBImpl * db_;
+        const size_t start_seq_;
+        const uint32_t keyspace_; // 只返回带有此标记的记录
+        std::map<size_t, size_t> offsets_; // 各 Store 下一条待读记录的位置, 读完的封存 Store 为 kDone
+
+        std::unique_ptr<Store> store_; // 正在读取的 Store
+        size_t store_seq_;
+        size_t limit_; // 已知的文件长度, 读到此处时重新获取
+
+        bool valid_;
+        Type type_;
+        size_t seq_;
+        size_t id_;
+        uint64_t expire_;
+        std::string buf_;
+        std::string value_;
+        Slice k_;
+        Slice v_;
+
+    public:
+        UpdateIteratorImpl(DBImpl * db, size_t seq, size_t id, uint32_t keyspace);
+
+        UpdateIteratorImpl(const UpdateIteratorImpl &) = delete;
+
+        UpdateIteratorImpl & operator=(const UpdateIteratorImpl &) = delete;
+
+    public:
+        bool Valid() const override { return valid_; }
+
+        void Next() override;
+
+        Type GetType() const override { return type_; }
+
+        Slice Key() const override { return k_; }
+
+        Slice Value() const override { return v_; }
+
+        uint64_t Expire() const override { return expire_; }
+
+        size_t Seq() const override { return seq_; }
+
+        size_t Id() const override { return id_; }
+
+    private:
+        // Store 已被删除时返回 false
+        bool OpenStore(size_t seq);
+
+        bool RefreshLimit();
+
+        // 读出 store_ 中的下一条记录, 没有新记录时返回 false
+        bool ReadRecord();
+
+        bool Decode(size_t id, uint32_t k_len, uint32_t flags, const char * p, size_t n);
+    };
+}
+
+#endif //LEVIDB_UPDATE_ITERATOR_IMPL_H
\ No newline at end of file
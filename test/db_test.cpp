@@ -1,5 +1,9 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
 #include <iostream>
 #include <map>
+#include <stdexcept>
 #include <thread>
 
 #include "env.h"
@@ -13,7 +17,7 @@ namespace levidb::db_test {
 
     public:
         void Set(const Slice & k, const Slice & v) override {
-            map_.emplace(k.ToString(), v.ToString());
+            map_[k.ToString()] = v.ToString();
         }
 
         bool Get(const Slice & k, std::string * v) const override {
@@ -49,6 +53,36 @@ namespace levidb::db_test {
         }
     };
 
+    class SliceReader : public ValueReader {
+    private:
+        Slice s_;
+        size_t offset_ = 0;
+
+    public:
+        explicit SliceReader(const Slice & s) : s_(s) {}
+
+        size_t Read(size_t n, char * scratch) override {
+            n = std::min(n, s_.size() - offset_);
+            memcpy(scratch, s_.data() + offset_, n);
+            offset_ += n;
+            return n;
+        }
+    };
+
+    class AppendOperator : public MergeOperator {
+    public:
+        void Merge(const Slice & k, const Slice * existing, const Slice & operand,
+                   std::string * result) const override {
+            if (operand == "!") {
+                throw std::invalid_argument("rejected operand");
+            }
+            if (existing != nullptr) {
+                result->assign(existing->data(), existing->size());
+            }
+            result->append(operand.data(), operand.size());
+        }
+    };
+
     void Run() {
         constexpr char kPathDB[] = "/tmp/levi-db";
         constexpr unsigned int kTestTimes = 10000;
@@ -119,6 +153,442 @@ namespace levidb::db_test {
                     job.join();
                 }
                 assert(result[0] == result[1]);
+
+                std::atomic<size_t> scanned(0);
+                db->ParallelScan(kThreadNum, [&](const Slice & k, const Slice & v) {
+                    scanned += k.size() + v.size();
+                    return true;
+                }, nullptr, nullptr);
+                assert(scanned == result[0]);
+
+                scanned = 0;
+                db->PhysicalScan(kThreadNum, [&](const Slice & k, const Slice & v) {
+                    scanned += k.size() + v.size();
+                    return true;
+                });
+                assert(scanned == result[0]);
+
+                size_t n = 0;
+                auto iter = db->GetIterator();
+                for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+                    ++n;
+                }
+                assert(db->Count() == n);
+                Range range;
+                uint64_t count;
+                uint64_t bytes;
+                db->GetApproximateCount(&range, 1, &count);
+                db->GetApproximateSizes(&range, 1, &bytes);
+                assert(count == n && bytes > 0);
+            }
+            {
+                std::string k = "stream";
+                std::string v(3 * 1024 * 1024 + 7, 0);
+                for (size_t i = 0; i < v.size(); ++i) {
+                    v[i] = static_cast<char>(i * 31);
+                }
+                SliceReader reader(v);
+                db->AddStream(k, &reader);
+
+                std::string buf;
+                db->Get(k, &buf);
+                assert(buf == v);
+
+                buf.clear();
+                char chunk[4096];
+                auto stream = db->GetStream(k);
+                for (size_t n; (n = stream->Read(sizeof(chunk), chunk)) != 0;) {
+                    buf.append(chunk, n);
+                }
+                assert(buf == v);
+                assert(db->GetStream(k + "_") == nullptr);
+
+                auto blobs = [&]() {
+                    std::vector<std::string> children;
+                    env->GetChildren(kPathDB, &children);
+                    return std::count_if(children.cbegin(), children.cend(), [](const std::string & child) {
+                        return child.compare(0, 5, "blob_") == 0;
+                    });
+                };
+                assert(blobs() == 1);
+                SliceReader again(v);
+                db->AddStream(k, &again); // 旧 blob 随覆盖删除
+                assert(blobs() == 1);
+                db->Del(k);
+                assert(blobs() == 0);
+            }
+            {
+                auto loader = db->NewBulkLoader(true);
+                for (size_t i = 0; i < kTestTimes; ++i) {
+                    char k[32];
+                    snprintf(k, sizeof(k), "bulk_%08zu", i);
+                    assert(loader->Add(k, std::to_string(i)).Ok());
+                }
+                assert(loader->Add("bulk_00000000", "again").Ok());
+                assert(loader->Add(std::string(1 << 24, 'k'), "v").IsInvalidArgument());
+                loader->Finish();
+
+                std::string buf;
+                db->Get("bulk_00000000", &buf);
+                assert(buf == "again");
+                db->Get("bulk_00000042", &buf);
+                assert(buf == "42");
+
+                db->Add("bulk_live_add", "old");
+                db->Add("bulk_live_del", "old");
+                db->Add("bulk_live_old", "old");
+                auto live = db->NewBulkLoader(false);
+                live->Add("bulk_live_add", "loaded");
+                live->Add("bulk_live_del", "loaded");
+                live->Add("bulk_live_old", "loaded");
+                db->Add("bulk_live_add", "live"); // 导入期间的写入与删除不被覆盖
+                db->Del("bulk_live_del");
+                live->Finish();
+                assert(db->Get("bulk_live_add", &buf) && buf == "live");
+                assert(!db->Get("bulk_live_del", &buf));
+                assert(db->Get("bulk_live_old", &buf) && buf == "loaded");
+            }
+            {
+                assert(db->Add("status", "v").Ok());
+                assert(db->Merge("status", "v").IsNotSupported()); // 未提供 merge_operator
+                assert(db->Add(std::string(1 << 24, 'k'), "v").IsInvalidArgument()); // key 长度上限 2^24 - 1
+            }
+            {
+                std::string big(8192, 'x'); // 超过 value_separate_threshold, 单独存放
+                db->Add("separated", big);
+                std::string buf;
+                assert(db->Get("separated", &buf) && buf == big);
+
+                size_t n = 0;
+                auto iter = db->GetIterator();
+                for (iter->Seek("separated"); iter->Valid() && iter->Key() == "separated"; iter->Next()) {
+                    ++n; // 只读 key, 不读分离的 value
+                }
+                assert(n == 1);
+                iter->Seek("separated");
+                assert(iter->Valid() && iter->Value() == big);
+            }
+            {
+                db->Add("feed", "1");
+                db->Del("feed");
+                db->Sync();
+                bool put = false;
+                bool del = false;
+                auto updates = db->GetUpdatesSince(0, 0);
+                for (; updates->Valid(); updates->Next()) {
+                    if (updates->Key() == "feed") {
+                        put = put || (updates->GetType() == UpdateIterator::kPut && updates->Value() == "1");
+                        del = del || (put && updates->GetType() == UpdateIterator::kDel);
+                    }
+                }
+                assert(put && del);
+
+                db->Add("feed", "2");
+                db->Sync();
+                updates->Next(); // 继续读取新落盘的记录
+                assert(updates->Valid() && updates->Key() == "feed" && updates->Value() == "2");
+            }
+            {
+                std::string buf;
+                bool done;
+                assert(db->PutIfAbsent("cas", "1", &done).Ok() && done);
+                assert(db->PutIfAbsent("cas", "2", &done).Ok() && !done);
+                assert(db->CompareAndSwap("cas", "2", "3", &done).Ok() && !done);
+                assert(db->CompareAndSwap("cas", "1", "3", &done).Ok() && done);
+                assert(db->Get("cas", &buf) && buf == "3");
+                assert(db->CompareAndSwap("cas_absent", "", "1", &done).Ok() && !done);
+                assert(db->PutIfAbsent(std::string(1 << 24, 'k'), "v", &done).IsInvalidArgument() && !done);
+
+                db->Add("cas_ttl", "1", std::chrono::seconds(3600));
+                assert(db->CompareAndSwap("cas_ttl", "1", "2", &done).Ok() && done);
+                db->Sync();
+                uint64_t expire = 0;
+                for (auto updates = db->GetUpdatesSince(0, 0); updates->Valid(); updates->Next()) {
+                    if (updates->Key() == "cas_ttl" && updates->Value() == "2") {
+                        expire = updates->Expire(); // 新值继承旧值的过期时间
+                    }
+                }
+                assert(expire != 0);
+            }
+            {
+                std::string buf;
+                db->Add("ttl_expired", "v", std::chrono::seconds(0));
+                db->Add("ttl_alive", "v", std::chrono::seconds(3600));
+                assert(!db->Get("ttl_expired", &buf));
+                assert(db->Get("ttl_alive", &buf) && buf == "v");
+                auto iter = db->GetIterator();
+                for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+                    assert(iter->Key() != "ttl_expired");
+                }
+            }
+            {
+                // 新 key 不继承相邻记录的过期时间, 不带 ttl 的覆盖清除旧的过期时间
+                std::string buf;
+                db->Add("ttl_neighbour", "v", std::chrono::seconds(0));
+                db->Add("ttl_neighbour2", "v");
+                assert(db->Get("ttl_neighbour2", &buf) && buf == "v");
+                db->Add("ttl_reset", "v", std::chrono::seconds(0));
+                db->Add("ttl_reset", "w");
+                assert(db->Get("ttl_reset", &buf) && buf == "w");
+            }
+            {
+                std::string buf;
+                DB * users = db->OpenKeyspace("users", OpenOptions());
+                assert(db->OpenKeyspace("users", OpenOptions()) == users);
+                users->Add("ks", "users");
+                db->Add("ks", "default");
+                assert(users->Get("ks", &buf) && buf == "users");
+                assert(db->Get("ks", &buf) && buf == "default");
+                assert(users->Count() == 1);
+                users->Add("ks_only", "users");
+
+                WriteBatch batch;
+                batch.Add(users, "ks_batch", "1");
+                batch.Add(db.get(), "ks_batch", "2");
+                batch.Del(users, "ks");
+                db->Write(batch);
+                assert(users->Get("ks_batch", &buf) && buf == "1");
+                assert(db->Get("ks_batch", &buf) && buf == "2");
+                assert(!users->Get("ks", &buf));
+                assert(db->Get("ks", &buf) && buf == "default");
+
+                // 变更流按记录的 keyspace 标记区分同名 key, batch 的提交标记不出现在其中
+                db->Sync();
+                std::vector<std::string> seen;
+                for (auto updates = db->GetUpdatesSince(0, 0); updates->Valid(); updates->Next()) {
+                    assert(updates->Key() != "ks_only");
+                    assert(updates->GetType() == UpdateIterator::kDel || updates->Value() != "users");
+                    if (updates->Key() == "ks_batch") {
+                        assert(updates->Value() == "2");
+                    }
+                }
+                for (auto updates = users->GetUpdatesSince(0, 0); updates->Valid(); updates->Next()) {
+                    seen.emplace_back(updates->Key().ToString() + (updates->GetType() == UpdateIterator::kDel
+                                                                   ? "-" : "=" + updates->Value().ToString()));
+                }
+                assert((seen == std::vector<std::string>{"ks=users", "ks_only=users", "ks_batch=1", "ks-"}));
+
+                WriteBatch invalid;
+                invalid.Add(users, "ks_invalid", "1");
+                invalid.Add(db.get(), std::string(16 * 1024 * 1024, 'k'), "2"); // key 过长
+                assert(db->Write(invalid).IsInvalidArgument());
+                assert(!users->Get("ks_invalid", &buf)); // 不留下部分写入
+            }
+        }
+        env->DeleteAll(kPathDB);
+
+        {
+            ManifestorImpl manifestor;
+            OpenOptions options{&manifestor};
+            AppendOperator append;
+            options.merge_operator = &append;
+            options.shard_affinity = true;
+            options.write_buffer_size = 64 * 1024;
+            options.write_flush_interval_ms = 10;
+            auto db = DB::Open(kPathDB, options);
+
+            std::vector<std::future<void>> adds;
+            TextProvider provider;
+            for (size_t i = 0; i < kTestTimes; ++i) {
+                auto[k, v] = provider.ReadItem();
+                adds.emplace_back(db->AddAsync(k, v));
+            }
+            for (auto & add:adds) {
+                add.get();
+            }
+
+            std::string buf;
+            provider = TextProvider();
+            for (size_t i = 0; i < kTestTimes; ++i) {
+                auto[k, v] = provider.ReadItem();
+                bool success = db->GetAsync(k, &buf).get();
+                assert(success && v == buf);
+                if (i % 2 == 0) {
+                    db->DelAsync(k).get();
+                    assert(!db->Get(k, &buf));
+                }
+            }
+
+            std::string expected;
+            for (size_t i = 0; i < 100; ++i) {
+                std::string operand = std::to_string(i);
+                db->Merge("merge", operand);
+                expected += operand;
+            }
+            db->Get("merge", &buf);
+            assert(buf == expected);
+        }
+        env->DeleteAll(kPathDB);
+
+        {
+            OpenOptions options; // 内置 Manifestor
+            options.level_paths = {std::string(kPathDB) + "/hot", std::string(kPathDB) + "/cold"};
+            options.cold_store_age = 3600;
+            {
+                auto db = DB::Open(kPathDB, options);
+                db->Add("manifest", "v");
+                db->Compact();
+            }
+            std::string buf;
+            auto db = DB::Open(kPathDB, options);
+            assert(db->Get("manifest", &buf) && buf == "v");
+        }
+        env->DeleteAll(kPathDB);
+
+        {
+            OpenOptions options;
+            options.level_paths = {std::string(kPathDB) + "/hot", std::string(kPathDB) + "/cold"};
+            options.cold_store_age = 1;
+            auto stores = [&](const std::string & dir) {
+                std::vector<std::string> children;
+                env->GetChildren(dir, &children);
+                return std::count_if(children.cbegin(), children.cend(), [](const std::string & child) {
+                    return child.compare(0, 6, "store_") == 0;
+                });
+            };
+            {
+                auto db = DB::Open(kPathDB, options);
+                db->Add("cold", "v");
+            }
+            {
+                auto db = DB::Open(kPathDB, options); // 上次的 Store 已封存
+                std::this_thread::sleep_for(std::chrono::seconds(2));
+                db->Compact();
+                assert(stores(std::string(kPathDB) + "/cold") == 1);
+            }
+            std::string buf;
+            auto db = DB::Open(kPathDB, options);
+            assert(db->Get("cold", &buf) && buf == "v");
+        }
+        env->DeleteAll(kPathDB);
+
+        {
+            OpenOptions options;
+            {
+                auto db = DB::Open(kPathDB, options);
+                db->OpenKeyspace("expire_ks", OpenOptions())->Add("ks", "v", std::chrono::seconds(0));
+            }
+            auto stores = [&]() {
+                std::vector<std::string> children;
+                env->GetChildren(kPathDB, &children);
+                return std::count_if(children.cbegin(), children.cend(), [](const std::string & child) {
+                    return child.compare(0, 6, "store_") == 0;
+                });
+            };
+            auto db = DB::Open(kPathDB, options);
+            auto before = stores();
+            db->Compact(); // 未打开的 keyspace 同样被清理
+            assert(stores() == before - 1);
+            assert(db->OpenKeyspace("expire_ks", OpenOptions())->Count() == 0);
+        }
+        env->DeleteAll(kPathDB);
+
+        {
+            OpenOptions options;
+            options.lookup_filter = true;
+            {
+                auto db = DB::Open(kPathDB, options);
+                for (size_t i = 0; i < kTestTimes; ++i) {
+                    db->Add("filter_" + std::to_string(i), std::to_string(i));
+                }
+                for (size_t i = 0; i < kTestTimes; i += 2) {
+                    db->Del("filter_" + std::to_string(i));
+                }
+            }
+            std::string buf;
+            auto db = DB::Open(kPathDB, options); // filter 从文件载入
+            for (size_t i = 0; i < kTestTimes; ++i) {
+                bool found = db->Get("filter_" + std::to_string(i), &buf);
+                assert(found == (i % 2 == 1) && (!found || buf == std::to_string(i)));
+            }
+            assert(!db->Get("filter_absent", &buf));
+        }
+        env->DeleteAll(kPathDB);
+
+        {
+            OpenOptions options;
+            options.mmap_store_limit = 1024 * 1024 * 1024;
+            {
+                auto db = DB::Open(kPathDB, options);
+                for (size_t i = 0; i < kTestTimes; ++i) {
+                    db->Add("mmap_" + std::to_string(i), std::to_string(i));
+                }
+            }
+            std::string buf;
+            auto db = DB::Open(kPathDB, options); // 之前的 Store 不再写入, 以 mmap 读取
+            for (size_t i = 0; i < kTestTimes; ++i) {
+                assert(db->Get("mmap_" + std::to_string(i), &buf) && buf == std::to_string(i));
+            }
+            size_t n = 0;
+            auto iter = db->GetIterator(); // 迭代期间映射提示为顺序访问
+            for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+                assert(iter->Key().ToString().compare(0, 5, "mmap_") == 0);
+                ++n;
+            }
+            assert(n == kTestTimes);
+        }
+        env->DeleteAll(kPathDB);
+
+        {
+            OpenOptions options;
+            AppendOperator append;
+            options.merge_operator = &append;
+            auto db = DB::Open(kPathDB, options);
+            std::string expected;
+            for (size_t i = 0; i < 15; ++i) { // 下一次 merge 时折叠
+                db->Merge("combine_err", "m");
+                expected += "m";
+            }
+
+            std::atomic<bool> rejected(false);
+            std::vector<std::thread> jobs;
+            for (size_t i = 0; i < kThreadNum; ++i) {
+                jobs.emplace_back([&](size_t nth) {
+                    std::string k = "combine_" + std::to_string(nth);
+                    for (size_t j = 0; j < kTestTimes; ++j) {
+                        db->Add(k, std::to_string(j));
+                        db->Add("combine_shared", k); // 同一批中的相邻 Add 合并为一次
+                        if (j % 64 == 0) { // 分离的 value 与过期时间随同一批追加
+                            db->Add(k + "_big", std::string(8192, static_cast<char>('a' + nth)), std::chrono::seconds(3600));
+                        }
+                    }
+                    if (nth == 0) {
+                        rejected = db->Merge("combine_err", "!").IsInvalidArgument(); // 异常只交给出错的操作
+                    }
+                }, i);
+            }
+            for (auto & job:jobs) {
+                job.join();
+            }
+            assert(rejected);
+
+            std::string buf;
+            for (size_t i = 0; i < kThreadNum; ++i) {
+                assert(db->Get("combine_" + std::to_string(i), &buf) && buf == std::to_string(kTestTimes - 1));
+                assert(db->Get("combine_" + std::to_string(i) + "_big", &buf)
+                       && buf == std::string(8192, static_cast<char>('a' + i)));
+            }
+            assert(db->Get("combine_shared", &buf) && buf.compare(0, 8, "combine_") == 0);
+            assert(db->Get("combine_err", &buf) && buf == expected);
+        }
+        env->DeleteAll(kPathDB);
+
+        {
+            auto db = DB::Open(kPathDB, OpenOptions());
+            std::vector<std::thread> jobs;
+            for (size_t i = 0; i < kThreadNum; ++i) {
+                jobs.emplace_back([&](size_t nth) { // 各 shard 并发追加到同一个 Store, 写后立即读回
+                    std::string buf;
+                    for (size_t j = 0; j < kTestTimes; ++j) {
+                        std::string k = "append_" + std::to_string(nth) + "_" + std::to_string(j);
+                        std::string v(j % 512 + 1, static_cast<char>('a' + nth));
+                        db->Add(k, v);
+                        assert(db->Get(k, &buf) && buf == v);
+                    }
+                }, i);
+            }
+            for (auto & job:jobs) {
+                job.join();
             }
         }
         std::cout << __PRETTY_FUNCTION__ << " - OK" << std::endl;